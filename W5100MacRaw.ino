@@ -1,82 +1,82 @@
 #include "w5100.h"
+#include "w5100_dispatch.h"
+#include "w5100_log.h"
 
 
-void printPaddedHex(uint8_t byte)
-{
-    char str[2];
-    str[0] = (byte >> 4) & 0x0f;
-    str[1] = byte & 0x0f;
-
-    for (int i=0; i<2; i++) {
-        // base for converting single digit numbers to ASCII is 48
-        // base for 10-16 to become lower-case characters a-f is 87
-        if (str[i] > 9) str[i] += 39;
-        str[i] += 48;
-        Serial.print(str[i]);
-    }
-}
+const byte mac_address[] = {
+    0xae, 0x03, 0xf3, 0xc7, 0x08, 0x78
+};
+
+// Set to 1 if the Ethernet module has a W5500 rather than a W5100
+#ifndef USE_W5500
+#define USE_W5500 0
+#endif
+
+#if USE_W5500
+WiznetW5500Bus w5500;
+Wiznet5100 w5100(w5500);
+#else
+WiznetSpiBus spi;
+Wiznet5100 w5100(spi);
+#endif
+EthernetDispatcher dispatcher(w5100);
+
+// Printing each frame as it arrives would take milliseconds at 115200 baud,
+// so frames are logged in binary and written out when there's nothing else
+// to do. Use logdecode to turn the Serial output back into text.
+FrameLog frameLog;
 
-void printMACAddress(const uint8_t address[6])
+uint8_t send_count=0;
+
+// Put our counter in byte 14 of the reply
+void setCounter(uint8_t *data, uint16_t offset, uint16_t len, void *)
 {
-    for (uint8_t i = 0; i < 6; ++i) {
-        printPaddedHex(address[i]);
-        if (i < 5)
-            Serial.print(':');
+    if (offset <= 14 && offset + len > 14) {
+        data[14 - offset] = send_count++;
     }
-    Serial.println();
 }
 
+// Reply to the 0x88B5 Local Experimental Ethertype
+void handleEcho(const EthernetDispatcher::Header &header, Wiznet5100::FrameReader &frame, void *)
+{
+    uint8_t payload[2] = {0, 0};
+    frame.read(payload, sizeof(payload));
 
+    frameLog.add(header.destination, header.source, header.ethertype, frame.length(), payload[1]);
 
-const byte mac_address[] = {
-    0xae, 0x03, 0xf3, 0xc7, 0x08, 0x78
-};
-
-Wiznet5100 w5100;
+    // Send it back without copying the whole frame into RAM
+    w5100.reflectFrame(frame, setCounter);
+}
 
 void setup() {
     // Setup serial port for debugging
     Serial.begin(115200);
     Serial.println("[W5100MacRaw]");
 
-    w5100.begin(mac_address);
+    // Only receive the frames that we reply to
+    w5100.addEtherType(0x88B5);
+    dispatcher.addHandler(0x88B5, handleEcho);
+
+    // Use the fastest SPI clock that works with this board
+    w5100.setClockCalibration(true);
+    if (w5100.begin(mac_address)) {
+        Serial.print("SPI clock=");
+        Serial.println(w5100.spiClock(), DEC);
+    } else {
+        Serial.println("Failed to set up the Ethernet controller");
+    }
 }
 
-
-uint8_t buffer[800];
-uint8_t send_count=0;
-
 void loop() {
+    // Pass any received frame to its handler
+    boolean received = dispatcher.dispatch();
+
+    // Send any replies that are waiting
+    Wiznet5100::TxStatus status = w5100.poll();
 
-    uint16_t len = w5100.readFrame(buffer, sizeof(buffer));
-    if ( len > 0 ) {
-        Serial.print("Len=");
-        Serial.println(len, DEC);
-
-        Serial.print("Dest=");
-        printMACAddress(&buffer[0]);
-        Serial.print("Src=");
-        printMACAddress(&buffer[6]);
-
-        // 0x0800 = IPv4
-        // 0x0806 = ARP
-        // 0x86DD = IPv6
-        Serial.print("Type=0x");
-        printPaddedHex(buffer[12]);
-        printPaddedHex(buffer[13]);
-        Serial.println();
-        
-        // Reply to the 0x88B5 Local Experimental Ethertype
-        if (buffer[12] == 0x88 && buffer[13] == 0xB5) {
-            Serial.print("Byte 15=");
-            Serial.println(buffer[15], DEC);
-
-            memcpy(&buffer[0], &buffer[6], 6);   // Set Destination to Source
-            memcpy(&buffer[6], mac_address, 6);  // Set Source to our MAC address
-            buffer[14] = send_count++;
-            w5100.sendFrame(buffer, len);
-        }
-
-        Serial.println();
+    // When idle, write out a log record, if Serial can take it without waiting
+    if (!received && status == Wiznet5100::TxIdle &&
+        Serial.availableForWrite() >= FrameLog::RecordLength) {
+        frameLog.drain(Serial);
     }
 }
@@ -0,0 +1,299 @@
+/*
+ * Minimal Arduino API for building the driver on a Linux host
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <stdio.h>
+
+#include "w5100_model.h"
+
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static W5100Model *model = NULL;
+static unsigned long now = 0;
+static void (*handlers[256])(void);
+static uint8_t pin_state[256];
+static uint32_t dummy_port;
+
+
+void hostsim_attach(W5100Model *m)
+{
+    model = m;
+}
+
+W5100Model *hostsim_model()
+{
+    return model;
+}
+
+unsigned long hostsim_now()
+{
+    return now;
+}
+
+void hostsim_interrupt(uint8_t pin)
+{
+    if (handlers[pin])
+        handlers[pin]();
+}
+
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    pin_state[pin] = val;
+    if (model && pin == model->csPin())
+        model->select(val == LOW);
+}
+
+int digitalRead(uint8_t pin)
+{
+    if (model && pin == model->intPin())
+        return model->interruptAsserted() ? LOW : HIGH;
+    return pin_state[pin];
+}
+
+unsigned long millis(void)
+{
+    return micros() / 1000;
+}
+
+unsigned long micros(void)
+{
+    // Time moves on a little every time it is looked at,
+    // so that loops waiting for a timeout finish
+    return now++;
+}
+
+void delay(unsigned long ms)
+{
+    now += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    now += us;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int)
+{
+    handlers[interruptNum] = userFunc;
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+    handlers[interruptNum] = NULL;
+}
+
+uint8_t digitalPinToPort(uint8_t)
+{
+    return 0;
+}
+
+uint32_t digitalPinToBitMask(uint8_t pin)
+{
+    return 1UL << (pin % 32);
+}
+
+volatile uint32_t *portOutputRegister(uint8_t)
+{
+    return &dummy_port;
+}
+
+volatile uint32_t *portInputRegister(uint8_t)
+{
+    return &dummy_port;
+}
+
+volatile uint32_t *portModeRegister(uint8_t)
+{
+    return &dummy_port;
+}
+
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(const char str[])
+{
+    return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t Print::print(int n, int base)
+{
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == DEC && n < 0)
+        return print('-') + printNumber(-n, base);
+    return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return print(str);
+}
+
+size_t Print::println(void)
+{
+    return print("\r\n");
+}
+
+size_t Print::println(const char str[])
+{
+    return print(str) + println();
+}
+
+size_t Print::println(char c)
+{
+    return print(c) + println();
+}
+
+size_t Print::println(int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base)
+{
+    return print(n, base) + println();
+}
+
+
+void HardwareSerial::begin(unsigned long)
+{
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+    return 64;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    if (enabled)
+        putchar(c);
+    return 1;
+}
+
+
+void SPIClass::begin()
+{
+    clock = 4000000;
+}
+
+void SPIClass::end()
+{
+}
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+    // The fastest clock at or below the setting, as on a 16 MHz AVR
+    clock = 8000000;
+    while (clock > settings.clock && clock > 125000)
+        clock /= 2;
+}
+
+void SPIClass::endTransaction(void)
+{
+}
+
+void SPIClass::setBitOrder(uint8_t)
+{
+}
+
+void SPIClass::setDataMode(uint8_t)
+{
+}
+
+void SPIClass::setClockDivider(uint8_t clockDiv)
+{
+    // Dividers of the 16 MHz clock of an Arduino Uno
+    static const uint8_t dividers[] = {4, 16, 64, 128, 2, 8, 32, 64};
+    clock = 16000000 / dividers[clockDiv & 0x07];
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+    if (model)
+        return model->transfer(data, clock);
+    return 0x00;
+}
@@ -0,0 +1,283 @@
+/*
+ * Linux programme that moves frames in the background with submitReceive() and submitSend()
+ *
+ * The driver is given a simulated bus whose transfers only complete after a
+ * set delay, or WiznetSpiInterruptBus, which moves a few bytes each time it
+ * is serviced. Frames are echoed while the programme counts how much other
+ * work it gets done as they move, and every reply is checked.
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "w5100.h"
+#include "w5100_model.h"
+
+
+/**
+ * A bus that completes transfers a set time after they are submitted
+ *
+ * The data is only moved when the transfer completes, so a driver that
+ * used the buffer too early would see the wrong contents.
+ */
+class DelayedBus : public WiznetBus {
+
+public:
+    /**
+     * @param bus the bus that really moves the data
+     * @param delay the time each transfer takes, in microseconds
+     */
+    DelayedBus(WiznetBus &bus, uint32_t delay) : _bus(bus), _delay(delay), _busy(false) {}
+
+    void begin() { _bus.begin(); }
+    uint8_t read(uint16_t address) { finish(); return _bus.read(address); }
+    void write(uint16_t address, uint8_t data) { finish(); _bus.write(address, data); }
+    void readBuf(uint16_t address, uint8_t *pBuf, uint16_t len) { finish(); _bus.readBuf(address, pBuf, len); }
+    void writeBuf(uint16_t address, const uint8_t *pBuf, uint16_t len) { finish(); _bus.writeBuf(address, pBuf, len); }
+    void setClock(uint32_t clock) { _bus.setClock(clock); }
+    uint32_t clock() const { return _bus.clock(); }
+
+    void submitRead(uint16_t address, uint8_t *pBuf, uint16_t len, Completion done, void *context)
+    {
+        submit(address, pBuf, NULL, len, done, context);
+    }
+
+    void submitWrite(uint16_t address, const uint8_t *pBuf, uint16_t len, Completion done, void *context)
+    {
+        submit(address, NULL, pBuf, len, done, context);
+    }
+
+    void service()
+    {
+        if (_busy && micros() - _started >= _delay)
+            complete();
+    }
+
+    void cancel() { _busy = false; }
+
+private:
+    WiznetBus &_bus;
+    uint32_t _delay;
+    bool _busy;
+    uint32_t _started;
+    uint16_t _address;
+    uint8_t *_rx_buf;
+    const uint8_t *_tx_buf;
+    uint16_t _len;
+    Completion _done;
+    void *_context;
+
+    void submit(uint16_t address, uint8_t *rx_buf, const uint8_t *tx_buf, uint16_t len,
+                Completion done, void *context)
+    {
+        finish();
+        _address = address;
+        _rx_buf = rx_buf;
+        _tx_buf = tx_buf;
+        _len = len;
+        _done = done;
+        _context = context;
+        _started = micros();
+        _busy = true;
+    }
+
+    void complete()
+    {
+        if (_rx_buf)
+            _bus.readBuf(_address, _rx_buf, _len);
+        else
+            _bus.writeBuf(_address, _tx_buf, _len);
+        _busy = false;
+        _done(_context);
+    }
+
+    void finish()
+    {
+        while (_busy)
+            service();
+    }
+};
+
+
+static const uint8_t our_mac[6] = {0xae, 0x03, 0xf3, 0xc7, 0x08, 0x78};
+static const uint8_t their_mac[6] = {0x1e, 0x65, 0x55, 0x3c, 0x84, 0xc3};
+
+static uint16_t completed_len;
+static int completions;
+
+static void on_complete(uint16_t len, void *context)
+{
+    (void)context;
+    completed_len = len;
+    completions++;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: simasync [-5] [-i] [-d delay] [-n count]\n");
+    fprintf(stderr, "  -5         Talk to the model as a W5500\n");
+    fprintf(stderr, "  -i         Use WiznetSpiInterruptBus rather than a delayed bus (W5100 only)\n");
+    fprintf(stderr, "  -d delay   Time each transfer of the delayed bus takes, in microseconds (default 500)\n");
+    fprintf(stderr, "  -n count   Number of frames to echo (default 20)\n");
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool w5500 = false;
+    bool irq = false;
+    uint32_t delay = 500;
+    int count = 20;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "5id:n:")) != -1) {
+        switch (opt) {
+        case '5': w5500 = true; break;
+        case 'i': irq = true; break;
+        case 'd': delay = strtoul(optarg, NULL, 0); break;
+        case 'n': count = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (w5500 && irq)
+        usage();
+
+    W5100Model chip(10, 2, w5500 ? W5100Model::W5500 : W5100Model::W5100);
+    WiznetSpiBus spi_bus;
+    WiznetW5500Bus w5500_bus;
+    WiznetSpiInterruptBus irq_bus;
+    DelayedBus delayed_bus(w5500 ? (WiznetBus &)w5500_bus : (WiznetBus &)spi_bus, delay);
+    WiznetBus &bus = irq ? (WiznetBus &)irq_bus : (WiznetBus &)delayed_bus;
+    Wiznet5100 driver(bus);
+
+    hostsim_attach(&chip);
+    if (!driver.begin(our_mac)) {
+        fprintf(stderr, "Failed to set up the Ethernet controller\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t frame[1514], buf[1514], other[1514];
+        uint16_t frame_len = 60 + (i * 211) % (sizeof(frame) - 60);
+        std::vector<uint8_t> reply;
+        uint32_t rx_work = 0, tx_work = 0;
+        bool untouched, ok;
+
+        memcpy(&frame[0], our_mac, 6);
+        memcpy(&frame[6], their_mac, 6);
+        frame[12] = 0x88;
+        frame[13] = 0xB5;
+        for (uint16_t j = 14; j < frame_len; j++) {
+            frame[j] = (j * 3 + i) & 0xFF;
+        }
+        chip.injectFrame(frame, frame_len);
+
+        // Receive it, doing other work until it has arrived
+        memset(buf, 0x55, sizeof(buf));
+        completions = 0;
+        ok = driver.submitReceive(buf, sizeof(buf), on_complete);
+        untouched = buf[frame_len - 1] == 0x55;
+        while (completions == 0 && ok) {
+            rx_work++;
+            driver.poll();
+        }
+        ok = ok && completed_len == frame_len && memcmp(buf, frame, frame_len) == 0;
+
+        // Send it back, doing other work until it has been copied. Another
+        // frame arrives meanwhile, and can't be read until the bus is free.
+        memcpy(&buf[0], their_mac, 6);
+        memcpy(&buf[6], our_mac, 6);
+        chip.injectFrame(frame, frame_len);
+        completions = 0;
+        ok = ok && driver.submitSend(buf, frame_len, on_complete);
+        while (completions == 0 && ok) {
+            tx_work++;
+            if (driver.readFrame(other, sizeof(other)) != 0)
+                ok = false;
+            driver.poll();
+        }
+        while (driver.poll() == Wiznet5100::TxBusy);
+        ok = ok && driver.readFrame(other, sizeof(other)) == frame_len &&
+             memcmp(other, frame, frame_len) == 0;
+
+        ok = ok && completed_len == frame_len && chip.popSentFrame(reply) &&
+             reply.size() == frame_len && memcmp(&reply[0], their_mac, 6) == 0 &&
+             memcmp(&reply[12], &frame[12], frame_len - 12) == 0;
+
+        // The payload must only arrive in the background
+        if (!untouched || rx_work == 0 || tx_work == 0)
+            ok = false;
+        if (!ok)
+            failures++;
+
+        fprintf(stderr, "exchange=%d frame_len=%u rx_work=%u tx_work=%u %s\n",
+                i, frame_len, rx_work, tx_work, ok ? "ok" : "FAIL");
+    }
+
+    // Shut down while a frame is still arriving. The transfer can't finish
+    // in time, so it must be cancelled and never touch the buffer again.
+    {
+        uint8_t frame[1514], buf[1514];
+        Wiznet5100::Status status;
+        bool ok;
+
+        memcpy(&frame[0], our_mac, 6);
+        memcpy(&frame[6], their_mac, 6);
+        memset(&frame[12], 0xAA, sizeof(frame) - 12);
+        chip.injectFrame(frame, sizeof(frame));
+
+        memset(buf, 0x55, sizeof(buf));
+        completions = 0;
+        ok = driver.submitReceive(buf, sizeof(buf), on_complete);
+        status = driver.end(10);
+        ok = ok && status == Wiznet5100::StatusTimeout &&
+             completions == 1 && completed_len == 0;
+        for (int j = 0; j < 10000; j++) {
+            bus.service();
+        }
+        ok = ok && completions == 1 && buf[sizeof(buf) - 1] == 0x55;
+        if (!ok)
+            failures++;
+
+        fprintf(stderr, "exchange=%d aborted status=%d completions=%d %s\n",
+                count, status, completions, ok ? "ok" : "FAIL");
+        count++;
+    }
+
+    fprintf(stderr, "%d of %d exchanges failed\n", failures, count);
+    return failures ? 1 : 0;
+}
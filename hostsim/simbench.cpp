@@ -0,0 +1,408 @@
+/*
+ * Linux programme that benchmarks the driver against a simulated W5100
+ *
+ * Reads, sends and echoes frames of each size, at the start of the buffers
+ * and wrapping round their ends, and with the receive buffer partly full.
+ * The SPI traffic of each is counted by the model, and turned into a time
+ * with a simple cost model: the time to clock each byte, plus a fixed
+ * overhead for each byte and for each chip select.
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "w5100_model.h"
+
+// Benchmark the sketch's own driver and echo path
+#include "W5100MacRaw.ino"
+
+
+#if USE_W5500
+static const char *chip_name = "w5500";
+#else
+static const char *chip_name = "w5100";
+#endif
+
+static const uint16_t RingSize = 8192;
+static const uint16_t RingMask = RingSize - 1;
+static const uint16_t MinFrame = 60;
+static const uint16_t MaxFrame = 1514;
+static const uint8_t RxPrefix = 2;     /* MACRAW length prefix in the Rx buffer */
+
+static const uint16_t frame_sizes[] = { 60, 128, 256, 512, 1024, 1514 };
+static const uint8_t fill_levels[] = { 0, 25, 50, 75 };
+
+static const uint8_t their_mac[6] = {0x1e, 0x65, 0x55, 0x3c, 0x84, 0xc3};
+
+/** The cost model */
+static uint32_t spi_clock = 8000000;    /* Hz - the fastest clock of a 16 MHz AVR */
+static uint32_t byte_ns = 250;          /* Loop overhead for each byte */
+static uint32_t select_ns = 500;        /* Overhead for each chip select cycle */
+
+static W5100Model *chip;
+static uint16_t rx_pos;     /* Where the next received frame starts in the Rx buffer */
+static uint16_t tx_pos;     /* Where the next sent frame starts in the Tx buffer */
+
+struct Result {
+    const char *op;
+    uint16_t len;
+    const char *position;
+    uint8_t fill;
+    uint32_t transfers;
+    uint32_t chip_selects;
+    uint32_t transactions;
+    double micros;
+    double frames_per_s;
+    double bytes_per_s;
+};
+
+static std::vector<Result> results;
+
+
+static void make_frame(uint8_t *frame, uint16_t len)
+{
+    memcpy(&frame[0], mac_address, 6);
+    memcpy(&frame[6], their_mac, 6);
+    frame[12] = 0x88;
+    frame[13] = 0xB5;
+    for (uint16_t i = 14; i < len; i++) {
+        frame[i] = i & 0xFF;
+    }
+}
+
+static void inject(uint16_t len)
+{
+    uint8_t frame[MaxFrame];
+
+    make_frame(frame, len);
+    if (!chip->injectFrame(frame, len)) {
+        fprintf(stderr, "The Rx buffer is full\n");
+        exit(-1);
+    }
+    rx_pos += len + RxPrefix;
+}
+
+static void receive_frame(uint16_t len)
+{
+    uint8_t buf[MaxFrame];
+
+    inject(len);
+    if (w5100.readFrame(buf, sizeof(buf)) != len) {
+        fprintf(stderr, "Failed to receive a %u byte frame\n", len);
+        exit(-1);
+    }
+}
+
+static void send_frame(uint16_t len)
+{
+    uint8_t frame[MaxFrame];
+    std::vector<uint8_t> sent;
+
+    make_frame(frame, len);
+    if (w5100.sendFrame(frame, len) != len || !chip->popSentFrame(sent) || sent.size() != len) {
+        fprintf(stderr, "Failed to send a %u byte frame\n", len);
+        exit(-1);
+    }
+    tx_pos += len;
+}
+
+/**
+ * Move a buffer pointer to a position, by passing frames through the buffer
+ * @param pos the pointer, which the step moves on
+ * @param target where the pointer should end up in the buffer
+ * @param overhead bytes added to each frame in the buffer
+ * @param step function that passes a frame through the buffer
+ */
+static void advance(uint16_t &pos, uint16_t target, uint16_t overhead, void (*step)(uint16_t len))
+{
+    const uint16_t min = MinFrame + overhead;
+    const uint16_t max = MaxFrame + overhead;
+    uint16_t delta = (target - pos) & RingMask;
+
+    // Too close to reach with one frame, so go all the way round
+    if (delta != 0 && delta < min)
+        delta += RingSize;
+
+    while (delta > 0) {
+        uint16_t n = delta;
+        if (n > max) {
+            n = max;
+            // Leave enough for a whole frame at the end
+            if (delta - n < min)
+                n = delta - min;
+        }
+        step(n - overhead);
+        delta -= n;
+    }
+}
+
+/** Where a frame starts in the buffer, for it to be at the start or wrap round the end */
+static uint16_t start_of(const char *position, uint16_t size)
+{
+    return strcmp(position, "wrap") == 0 ? RingSize - size / 2 : 0;
+}
+
+static void record(const char *op, uint16_t len, const char *position, uint8_t fill)
+{
+    const W5100Model::Counters &c = chip->counters();
+    Result r;
+
+    r.op = op;
+    r.len = len;
+    r.position = position;
+    r.fill = fill;
+    r.transfers = c.spiBytes;
+    r.chip_selects = c.chipSelects;
+    r.transactions = c.transactions;
+    r.micros = (c.spiBytes * (8000.0 / (spi_clock / 1000.0) + byte_ns) + c.chipSelects * (double)select_ns) / 1000.0;
+    r.frames_per_s = 1000000.0 / r.micros;
+    r.bytes_per_s = r.frames_per_s * len;
+    results.push_back(r);
+}
+
+static void bench_read(uint16_t len, const char *position, uint8_t fill)
+{
+    uint8_t buf[MaxFrame];
+    uint16_t backlog = 0;
+
+    advance(rx_pos, start_of(position, len + RxPrefix), RxPrefix, receive_frame);
+    inject(len);
+
+    // Frames that arrived after this one, filling the buffer to the level
+    while (backlog < (uint32_t)RingSize * fill / 100) {
+        uint16_t n = (uint32_t)RingSize * fill / 100 - backlog;
+        if (n > MaxFrame + RxPrefix)
+            n = MaxFrame + RxPrefix;
+        if (n < MinFrame + RxPrefix)
+            n = MinFrame + RxPrefix;
+        inject(n - RxPrefix);
+        backlog += n;
+    }
+
+    chip->resetCounters();
+    if (w5100.readFrame(buf, sizeof(buf)) != len) {
+        fprintf(stderr, "Failed to read a %u byte frame\n", len);
+        exit(-1);
+    }
+    record("readFrame", len, position, fill);
+
+    while (w5100.readFrame(buf, sizeof(buf)) > 0);
+}
+
+static void bench_send(uint16_t len, const char *position)
+{
+    advance(tx_pos, start_of(position, len), 0, send_frame);
+
+    chip->resetCounters();
+    send_frame(len);
+    record("sendFrame", len, position, 0);
+}
+
+static void bench_echo(uint16_t len, const char *position)
+{
+    std::vector<uint8_t> reply;
+
+    advance(rx_pos, start_of(position, len + RxPrefix), RxPrefix, receive_frame);
+    advance(tx_pos, start_of(position, len), 0, send_frame);
+    inject(len);
+
+    // The sketch's loop, until the reply has gone
+    chip->resetCounters();
+    for (int i = 0; i < 4 && chip->sentFrames() == 0; i++) {
+        loop();
+    }
+    if (!chip->popSentFrame(reply) || reply.size() != len) {
+        fprintf(stderr, "No reply to a %u byte frame\n", len);
+        exit(-1);
+    }
+    record("echo", len, position, 0);
+    tx_pos += len;
+}
+
+static void cost_model(char *buf, size_t size)
+{
+    snprintf(buf, size, "clock=%u byte_ns=%u select_ns=%u", spi_clock, byte_ns, select_ns);
+}
+
+static void print_csv()
+{
+    char model[80];
+
+    cost_model(model, sizeof(model));
+    printf("# %s\n", model);
+    printf("chip,op,frame_len,position,fill,transfers,chip_selects,transactions,micros,frames_per_s,bytes_per_s\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        printf("%s,%s,%u,%s,%u,%u,%u,%u,%.1f,%.0f,%.0f\n", chip_name, r.op, r.len, r.position, r.fill,
+               r.transfers, r.chip_selects, r.transactions, r.micros, r.frames_per_s, r.bytes_per_s);
+    }
+}
+
+static void print_json()
+{
+    printf("{\n  \"chip\": \"%s\",\n", chip_name);
+    printf("  \"cost_model\": {\"clock\": %u, \"byte_ns\": %u, \"select_ns\": %u},\n", spi_clock, byte_ns, select_ns);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        printf("    {\"op\": \"%s\", \"frame_len\": %u, \"position\": \"%s\", \"fill\": %u, "
+               "\"transfers\": %u, \"chip_selects\": %u, \"transactions\": %u, "
+               "\"micros\": %.1f, \"frames_per_s\": %.0f, \"bytes_per_s\": %.0f}%s\n",
+               r.op, r.len, r.position, r.fill, r.transfers, r.chip_selects, r.transactions,
+               r.micros, r.frames_per_s, r.bytes_per_s, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+/**
+ * Compare the results with a baseline written by an earlier run
+ * @return the number of results that are slower by more than the tolerance
+ */
+static int compare_baseline(const char *filename, double tolerance)
+{
+    char line[256], model[80];
+    int regressions = 0, compared = 0;
+    FILE *file = fopen(filename, "r");
+
+    if (!file) {
+        perror(filename);
+        exit(-1);
+    }
+
+    cost_model(model, sizeof(model));
+    while (fgets(line, sizeof(line), file)) {
+        char bchip[16], op[16], position[16];
+        unsigned len, fill, transfers, selects, transactions;
+        double micros, fps, bps;
+
+        if (line[0] == '#') {
+            line[strcspn(line, "\n")] = '\0';
+            if (strcmp(&line[2], model) != 0) {
+                fprintf(stderr, "%s was made with a different cost model (%s)\n", filename, &line[2]);
+                exit(-1);
+            }
+            continue;
+        }
+        if (sscanf(line, "%15[^,],%15[^,],%u,%15[^,],%u,%u,%u,%u,%lf,%lf,%lf", bchip, op, &len, position,
+                   &fill, &transfers, &selects, &transactions, &micros, &fps, &bps) != 11)
+            continue;
+        if (strcmp(bchip, chip_name) != 0)
+            continue;
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            if (strcmp(r.op, op) != 0 || r.len != len || strcmp(r.position, position) != 0 || r.fill != fill)
+                continue;
+
+            compared++;
+            double change = (r.frames_per_s - fps) * 100.0 / fps;
+            if (change < -tolerance) {
+                fprintf(stderr, "SLOWER: %s len=%u %s fill=%u: %.0f frames/s, was %.0f (%.1f%%)\n",
+                        op, len, position, fill, r.frames_per_s, fps, change);
+                regressions++;
+            } else if (change > tolerance) {
+                fprintf(stderr, "faster: %s len=%u %s fill=%u: %.0f frames/s, was %.0f (+%.1f%%)\n",
+                        op, len, position, fill, r.frames_per_s, fps, change);
+            }
+        }
+    }
+    fclose(file);
+
+    fprintf(stderr, "%d of %d results slower than %s by more than %.1f%%\n",
+            regressions, compared, filename, tolerance);
+    return compared ? regressions : 1;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: simbench [-j] [-c clock] [-B ns] [-S ns] [-b baseline] [-t percent]\n");
+    fprintf(stderr, "  -j           Write the results as JSON instead of CSV\n");
+    fprintf(stderr, "  -c clock     SPI clock of the cost model, in Hz (default %u)\n", spi_clock);
+    fprintf(stderr, "  -B ns        Overhead for each byte transferred (default %u)\n", byte_ns);
+    fprintf(stderr, "  -S ns        Overhead for each chip select (default %u)\n", select_ns);
+    fprintf(stderr, "  -b baseline  Compare with the CSV from an earlier run, and fail if slower\n");
+    fprintf(stderr, "  -t percent   How much slower is allowed (default 2)\n");
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    const char *baseline = NULL;
+    double tolerance = 2.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jc:B:S:b:t:")) != -1) {
+        switch (opt) {
+        case 'j': json = true; break;
+        case 'c': spi_clock = strtoul(optarg, NULL, 0); break;
+        case 'B': byte_ns = strtoul(optarg, NULL, 0); break;
+        case 'S': select_ns = strtoul(optarg, NULL, 0); break;
+        case 'b': baseline = optarg; break;
+        case 't': tolerance = atof(optarg); break;
+        default: usage();
+        }
+    }
+    if (spi_clock == 0)
+        usage();
+
+    W5100Model model(10, 2, USE_W5500 ? W5100Model::W5500 : W5100Model::W5100);
+    chip = &model;
+    hostsim_attach(chip);
+    Serial.enabled = false;
+    setup();
+
+    for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+        for (size_t f = 0; f < sizeof(fill_levels); f++) {
+            bench_read(frame_sizes[i], "start", fill_levels[f]);
+            bench_read(frame_sizes[i], "wrap", fill_levels[f]);
+        }
+        bench_send(frame_sizes[i], "start");
+        bench_send(frame_sizes[i], "wrap");
+        bench_echo(frame_sizes[i], "start");
+        bench_echo(frame_sizes[i], "wrap");
+    }
+
+    if (json)
+        print_json();
+    else
+        print_csv();
+
+    if (baseline)
+        return compare_baseline(baseline, tolerance) ? 1 : 0;
+
+    return 0;
+}
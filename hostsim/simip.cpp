@@ -0,0 +1,397 @@
+/*
+ * Linux programme that talks IPv4 to EthernetIPv4 through the model
+ *
+ * Sends ARP requests, pings and UDP datagrams of many lengths, and checks
+ * every reply, with the checksums worked out here independently. Datagrams
+ * with a bad checksum must not be echoed, and sending to an unknown address
+ * must ask for it with ARP first.
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "w5100.h"
+#include "w5100_dispatch.h"
+#include "w5100_ip.h"
+#include "w5100_model.h"
+
+
+static const uint8_t our_mac[6] = {0xae, 0x03, 0xf3, 0xc7, 0x08, 0x78};
+static const uint8_t their_mac[6] = {0x1e, 0x65, 0x55, 0x3c, 0x84, 0xc3};
+static const uint8_t other_mac[6] = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+static const uint8_t gateway_mac[6] = {0x02, 0x66, 0x77, 0x88, 0x99, 0xaa};
+static const uint8_t broadcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static const uint8_t our_ip[4] = {192, 168, 0, 10};
+static const uint8_t their_ip[4] = {192, 168, 0, 2};
+static const uint8_t other_ip[4] = {192, 168, 0, 3};
+static const uint8_t gateway_ip[4] = {192, 168, 0, 1};
+static const uint8_t remote_ip[4] = {10, 1, 2, 3};
+static const uint8_t broadcast_ip[4] = {192, 168, 0, 255};
+static const uint8_t subnet_mask[4] = {255, 255, 255, 0};
+static const uint16_t echo_port = 7;
+static const uint16_t their_port = 6000;
+
+static EthernetIPv4 *ipv4;
+static int echoed = 0;
+static int rejected = 0;
+
+
+/* The one's complement sum, done the slow way */
+static uint16_t checksum(const uint8_t *data, size_t len, uint32_t sum = 0)
+{
+    for (size_t i = 0; i < len; i++) {
+        sum += (i & 1) ? data[i] : data[i] << 8;
+    }
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum & 0xFFFF;
+}
+
+static uint32_t pseudo_header(const uint8_t *src, const uint8_t *dst, uint16_t len)
+{
+    return ((src[0] << 8) | src[1]) + ((src[2] << 8) | src[3]) +
+           ((dst[0] << 8) | dst[1]) + ((dst[2] << 8) | dst[3]) + 17 + len;
+}
+
+static void make_payload(uint8_t *data, uint16_t len, uint8_t counter)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = (i * 7 + counter) & 0xFF;
+    }
+}
+
+static uint16_t make_ethernet(uint8_t *frame, const uint8_t *dst, const uint8_t *src, uint16_t ethertype)
+{
+    memcpy(&frame[0], dst, 6);
+    memcpy(&frame[6], src, 6);
+    frame[12] = ethertype >> 8;
+    frame[13] = ethertype & 0xFF;
+    return 14;
+}
+
+static uint16_t make_arp(uint8_t *frame, uint16_t op, const uint8_t *sender_mac, const uint8_t *sender_ip,
+                         const uint8_t *target_mac, const uint8_t *target_ip)
+{
+    uint8_t *arp = &frame[make_ethernet(frame, op == 1 ? broadcast_mac : our_mac, sender_mac, 0x0806)];
+    const uint8_t fixed[6] = {0x00, 0x01, 0x08, 0x00, 6, 4};
+
+    memcpy(&arp[0], fixed, 6);
+    arp[6] = 0;
+    arp[7] = op;
+    memcpy(&arp[8], sender_mac, 6);
+    memcpy(&arp[14], sender_ip, 4);
+    memcpy(&arp[18], target_mac, 6);
+    memcpy(&arp[24], target_ip, 4);
+    return 14 + 28;
+}
+
+static uint16_t make_ip(uint8_t *frame, uint8_t protocol, const uint8_t *dst, uint16_t payload_len)
+{
+    uint8_t *ip = &frame[make_ethernet(frame, our_mac, their_mac, 0x0800)];
+    uint16_t total = 20 + payload_len;
+    uint16_t sum;
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[2] = total >> 8;
+    ip[3] = total & 0xFF;
+    ip[8] = 64;
+    ip[9] = protocol;
+    memcpy(&ip[12], their_ip, 4);
+    memcpy(&ip[16], dst, 4);
+    sum = checksum(ip, 20);
+    ip[10] = sum >> 8;
+    ip[11] = sum & 0xFF;
+    return 14 + 20;
+}
+
+static bool check_ip(const std::vector<uint8_t> &frame, uint8_t protocol, const uint8_t *dst_mac, const uint8_t *dst_ip)
+{
+    return frame.size() >= 34 &&
+           memcmp(&frame[0], dst_mac, 6) == 0 && memcmp(&frame[6], our_mac, 6) == 0 &&
+           frame[12] == 0x08 && frame[13] == 0x00 && frame[14] == 0x45 &&
+           frame[23] == protocol && checksum(&frame[14], 20) == 0 &&
+           memcmp(&frame[26], our_ip, 4) == 0 && memcmp(&frame[30], dst_ip, 4) == 0 &&
+           ((frame[16] << 8) | frame[17]) + 14u == frame.size();
+}
+
+static bool check_udp(const std::vector<uint8_t> &frame, const uint8_t *dst_mac, const uint8_t *dst_ip,
+                      uint16_t port, const uint8_t *payload, uint16_t len)
+{
+    if (!check_ip(frame, 17, dst_mac, dst_ip) || frame.size() != 42u + len)
+        return false;
+
+    const uint8_t *udp = &frame[34];
+    return ((udp[0] << 8) | udp[1]) == echo_port && ((udp[2] << 8) | udp[3]) == port &&
+           ((udp[4] << 8) | udp[5]) == 8 + len && (udp[6] | udp[7]) != 0 &&
+           checksum(udp, 8 + len, pseudo_header(our_ip, dst_ip, 8 + len)) == 0 &&
+           memcmp(&udp[8], payload, len) == 0;
+}
+
+/* Echo datagrams back, reading them in small odd-sized pieces */
+static void handle_echo(const EthernetIPv4::Datagram &datagram, EthernetIPv4::UdpReader &payload, void *)
+{
+    uint8_t buf[1500];
+    uint16_t len = 0;
+
+    while (payload.remaining() > 0) {
+        len += payload.read(&buf[len], 7);
+    }
+
+    if (!payload.valid()) {
+        rejected++;
+        return;
+    }
+
+    Wiznet5100::Status status = ipv4->sendTo(datagram.source, datagram.source_port, datagram.port, buf, len);
+    if (status != Wiznet5100::StatusOk) {
+        fprintf(stderr, "sendTo failed: status=%d\n", status);
+        return;
+    }
+    echoed++;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: simip [-5] [-n count]\n");
+    fprintf(stderr, "  -5         Talk to the model as a W5500\n");
+    fprintf(stderr, "  -n count   Number of pings and datagrams to send (default 20)\n");
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool w5500 = false;
+    int count = 20;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "5n:")) != -1) {
+        switch (opt) {
+        case '5': w5500 = true; break;
+        case 'n': count = atoi(optarg); break;
+        default: usage();
+        }
+    }
+
+    W5100Model chip(10, 2, w5500 ? W5100Model::W5500 : W5100Model::W5100);
+    WiznetW5500Bus w5500_bus;
+    Wiznet5100 w5100_spi;
+    Wiznet5100 w5100_w5500(w5500_bus);
+    Wiznet5100 &driver = w5500 ? w5100_w5500 : w5100_spi;
+    EthernetDispatcher dispatcher(driver);
+    EthernetIPv4 ip(driver, dispatcher);
+    uint8_t frame[1514];
+    std::vector<uint8_t> reply;
+    uint16_t len;
+    bool ok;
+
+    hostsim_attach(&chip);
+    if (!driver.begin(our_mac) || !ip.begin(our_ip, subnet_mask, gateway_ip)) {
+        fprintf(stderr, "Failed to set up the Ethernet controller\n");
+        return -1;
+    }
+    ipv4 = &ip;
+    ip.addUdpHandler(echo_port, handle_echo);
+
+    // They ask for our MAC address, which also tells us theirs
+    len = make_arp(frame, 1, their_mac, their_ip, broadcast_mac, our_ip);
+    chip.injectFrame(frame, len);
+    dispatcher.dispatch();
+    driver.poll();
+    ok = chip.popSentFrame(reply) && reply.size() == 42 &&
+         memcmp(&reply[0], their_mac, 6) == 0 && reply[21] == 2 &&
+         memcmp(&reply[22], our_mac, 6) == 0 && memcmp(&reply[28], our_ip, 4) == 0 &&
+         memcmp(&reply[32], their_mac, 6) == 0 && memcmp(&reply[38], their_ip, 4) == 0;
+    fprintf(stderr, "arp reply=%s\n", ok ? "ok" : "FAIL");
+    if (!ok)
+        failures++;
+
+    for (int i = 0; i < count; i++) {
+        uint8_t payload[1472];
+        uint16_t ping_len = 1 + (i * 37) % 1400;
+        uint16_t udp_len = (i * 61) % sizeof(payload);
+        bool ping_ok, udp_ok, bad_ok;
+        uint16_t sum;
+
+        // Ping, with an odd length every other time
+        len = make_ip(frame, 1, our_ip, 8 + ping_len);
+        uint8_t *icmp = &frame[len];
+        icmp[0] = 8;
+        icmp[1] = 0;
+        icmp[2] = icmp[3] = 0;
+        icmp[4] = 0x12;
+        icmp[5] = 0x34;
+        icmp[6] = i >> 8;
+        icmp[7] = i & 0xFF;
+        make_payload(&icmp[8], ping_len, i);
+        sum = checksum(icmp, 8 + ping_len);
+        icmp[2] = sum >> 8;
+        icmp[3] = sum & 0xFF;
+        len += 8 + ping_len;
+        chip.injectFrame(frame, len);
+        dispatcher.dispatch();
+        driver.poll();
+        ping_ok = chip.popSentFrame(reply) && check_ip(reply, 1, their_mac, their_ip) &&
+                  reply.size() == len && reply[34] == 0 &&
+                  checksum(&reply[34], 8 + ping_len) == 0 &&
+                  memcmp(&reply[38], &icmp[4], 4 + ping_len) == 0;
+
+        // Datagram to the echo port, sometimes broadcast and sometimes without a checksum
+        len = make_ip(frame, 17, (i % 3 == 2) ? broadcast_ip : our_ip, 8 + udp_len);
+        uint8_t *udp = &frame[len];
+        udp[0] = their_port >> 8;
+        udp[1] = their_port & 0xFF;
+        udp[2] = echo_port >> 8;
+        udp[3] = echo_port & 0xFF;
+        udp[4] = (8 + udp_len) >> 8;
+        udp[5] = (8 + udp_len) & 0xFF;
+        udp[6] = udp[7] = 0;
+        make_payload(payload, udp_len, i);
+        memcpy(&udp[8], payload, udp_len);
+        if (i % 4 != 3) {
+            sum = checksum(udp, 8 + udp_len, pseudo_header(their_ip, &frame[30], 8 + udp_len));
+            if (sum == 0)
+                sum = 0xFFFF;
+            udp[6] = sum >> 8;
+            udp[7] = sum & 0xFF;
+        }
+        len += 8 + udp_len;
+        // Short frames are padded, and the padding must not be read as payload
+        while (len < 60)
+            frame[len++] = 0xAA;
+        chip.injectFrame(frame, len);
+        dispatcher.dispatch();
+        driver.poll();
+        udp_ok = chip.popSentFrame(reply) && check_udp(reply, their_mac, their_ip, their_port, payload, udp_len);
+
+        // The same datagram with a byte of the payload changed
+        if (udp_len > 0 && (udp[6] | udp[7])) {
+            udp[8 + udp_len / 2] ^= 0x01;
+            chip.injectFrame(frame, len);
+            dispatcher.dispatch();
+            driver.poll();
+            bad_ok = chip.sentFrames() == 0;
+        } else {
+            bad_ok = true;
+        }
+
+        if (!ping_ok || !udp_ok || !bad_ok)
+            failures++;
+        fprintf(stderr, "exchange=%d ping_len=%u ping=%s udp_len=%u udp=%s bad_checksum=%s\n",
+                i, ping_len, ping_ok ? "ok" : "FAIL", udp_len, udp_ok ? "ok" : "FAIL",
+                bad_ok ? "rejected" : "FAIL");
+    }
+
+    // Addresses that aren't known yet are asked for first, and those
+    // outside the subnet are sent to the gateway
+    const uint8_t *targets[2] = {other_ip, remote_ip};
+    const uint8_t *hops[2] = {other_ip, gateway_ip};
+    const uint8_t *hop_macs[2] = {other_mac, gateway_mac};
+    for (int t = 0; t < 2; t++) {
+        const uint8_t data[5] = {'h', 'e', 'l', 'l', 'o'};
+        Wiznet5100::Status first, second, third;
+
+        first = ip.sendTo(targets[t], their_port, echo_port, data, sizeof(data));
+        driver.poll();
+        ok = first == Wiznet5100::StatusUnresolved && chip.popSentFrame(reply) &&
+             reply.size() == 42 && memcmp(&reply[0], broadcast_mac, 6) == 0 &&
+             reply[21] == 1 && memcmp(&reply[38], hops[t], 4) == 0;
+
+        // Trying again straight away doesn't send another request
+        second = ip.sendTo(targets[t], their_port, echo_port, data, sizeof(data));
+        ok = ok && second == Wiznet5100::StatusUnresolved && chip.sentFrames() == 0;
+
+        len = make_arp(frame, 2, hop_macs[t], hops[t], our_mac, our_ip);
+        chip.injectFrame(frame, len);
+        dispatcher.dispatch();
+        third = ip.sendTo(targets[t], their_port, echo_port, data, sizeof(data));
+        driver.poll();
+        ok = ok && third == Wiznet5100::StatusOk && chip.popSentFrame(reply) &&
+             check_ip(reply, 17, hop_macs[t], targets[t]);
+
+        if (!ok)
+            failures++;
+        fprintf(stderr, "resolve=%u.%u.%u.%u status=%d,%d,%d %s\n",
+                targets[t][0], targets[t][1], targets[t][2], targets[t][3],
+                first, second, third, ok ? "ok" : "FAIL");
+    }
+
+    // While a frame is being written in place, other frames wait for it
+    // and mustn't be written into its space
+    {
+        const uint8_t other[60] = {0};
+        Wiznet5100::Status status;
+        bool async_sent;
+
+        make_ethernet(frame, their_mac, our_mac, 0x88B5);
+        make_payload(&frame[14], 100, 0x5A);
+        Wiznet5100::FrameWriter writer = driver.beginSendFrame(114);
+        ok = (bool)writer && writer.write(frame, 50) == 50;
+        async_sent = driver.sendFrameAsync(other, sizeof(other));
+        status = driver.sendFrame(other, sizeof(other), 100);
+        ok = ok && !async_sent && status == Wiznet5100::StatusTimeout &&
+             !driver.beginSendFrame(60);
+
+        // An ARP request that arrives meanwhile can't be answered, and is counted
+        uint8_t request[60];
+        len = make_arp(request, 1, their_mac, their_ip, broadcast_mac, our_ip);
+        chip.injectFrame(request, len);
+        dispatcher.dispatch();
+        ok = ok && ip.arpDropped() == 1 && writer.write(&frame[50], 64) == 64;
+        writer.send();
+        driver.poll();
+        ok = ok && chip.popSentFrame(reply) && reply.size() == 114 &&
+             memcmp(&reply[0], frame, 114) == 0 && chip.sentFrames() == 0;
+
+        // Once it's gone, other frames can be sent again
+        writer = driver.beginSendFrame(60);
+        writer.cancel();
+        ok = ok && driver.sendFrameAsync(other, sizeof(other));
+        driver.poll();
+        ok = ok && chip.popSentFrame(reply) && reply.size() == sizeof(other);
+        if (!ok)
+            failures++;
+        fprintf(stderr, "writer async=%d status=%d %s\n", async_sent, status, ok ? "ok" : "FAIL");
+    }
+
+    driver.end();
+
+    fprintf(stderr, "echoed=%d rejected=%d checksum_errors=%u arp_dropped=%u\n", echoed, rejected,
+            ip.checksumErrors(), ip.arpDropped());
+    fprintf(stderr, "%d of %d exchanges failed\n", failures, count + 4);
+    return failures ? 1 : 0;
+}
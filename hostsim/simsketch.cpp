@@ -0,0 +1,266 @@
+/*
+ * Linux programme that runs the W5100MacRaw sketch against a simulated W5100
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "w5100_model.h"
+
+// Build the sketch itself against the simulated chip
+#include "W5100MacRaw.ino"
+
+
+static const uint8_t their_mac[6] = {0x1e, 0x65, 0x55, 0x3c, 0x84, 0xc3};
+static const uint8_t other_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+
+static void make_frame(uint8_t *frame, uint16_t len, const uint8_t *dest, uint16_t type, uint8_t counter)
+{
+    memcpy(&frame[0], dest, 6);
+    memcpy(&frame[6], their_mac, 6);
+    frame[12] = type >> 8;
+    frame[13] = type & 0xFF;
+    for (uint16_t i = 14; i < len; i++) {
+        frame[i] = i & 0xFF;
+    }
+    frame[14] = 0x00;
+    frame[15] = counter;
+}
+
+static bool check_reply(const std::vector<uint8_t> &reply, const uint8_t *request, uint16_t len, uint8_t count)
+{
+    if (reply.size() != len)
+        return false;
+    if (memcmp(&reply[0], &request[6], 6) != 0)
+        return false;
+    if (memcmp(&reply[6], mac_address, 6) != 0)
+        return false;
+    if (reply[14] != count)
+        return false;
+    return memcmp(&reply[12], &request[12], 2) == 0 &&
+           memcmp(&reply[15], &request[15], len - 15) == 0;
+}
+
+#if W5100_TRACE
+/** Stream that writes to a file, for the trace dump */
+class FilePrint : public Print {
+public:
+    FilePrint(FILE *file) : _file(file) {}
+    size_t write(uint8_t c) { return fputc(c, _file) == EOF ? 0 : 1; }
+    using Print::write;
+
+private:
+    FILE *_file;
+};
+#endif
+
+#if W5100_POOL_FRAMES
+/**
+ * Echo frames like the sketch does, but through the frame pool
+ * Every waiting frame is read into the queue before any replies are sent.
+ */
+static void pool_loop()
+{
+    static Wiznet5100::FrameQueue queue;
+    Wiznet5100::FrameHandle frame;
+
+    while (w5100.framesFree() > 0 && (frame = w5100.readFrame()) != Wiznet5100::NoFrame) {
+        queue.push(frame);
+    }
+
+    while ((frame = queue.pop()) != Wiznet5100::NoFrame) {
+        uint8_t *data = w5100.frameData(frame);
+        memcpy(&data[0], &data[6], 6);
+        memcpy(&data[6], mac_address, 6);
+        data[14] = send_count++;
+        w5100.sendFrame(frame);
+    }
+}
+#endif
+
+static void usage()
+{
+    fprintf(stderr, "Usage: simsketch [-q] [-i] [-m] [-p] [-c maxclock] [-w frame] [-n frames] [-t tracefile]\n");
+    fprintf(stderr, "  -q         Don't show the output of the sketch\n");
+    fprintf(stderr, "  -i         Use the INT pin instead of polling the chip\n");
+    fprintf(stderr, "  -m         Use the MAC filter in the chip, and reject multicast\n");
+    fprintf(stderr, "  -p         Echo through the frame pool instead of the sketch's loop() (needs W5100_POOL_FRAMES)\n");
+    fprintf(stderr, "  -c clock   Make the chip fail above this SPI clock, in Hz (at least 250000)\n");
+    fprintf(stderr, "  -w frame   Lock up the chip at this frame, then recover it with reinit()\n");
+    fprintf(stderr, "  -n frames  Number of echo requests to send (default 20)\n");
+    fprintf(stderr, "  -t file    Write the driver trace to a file (needs W5100_TRACE)\n");
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    W5100Model chip(10, 2, USE_W5500 ? W5100Model::W5500 : W5100Model::W5100);
+    bool interrupt = false;
+    bool macfilter = false;
+    bool pool = false;
+    uint32_t maxclock = 0;
+    const char *tracefile = NULL;
+    int frames = 20;
+    int wedge = -1;
+    int failures = 0;
+    uint32_t mac_filtered = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qimpc:w:n:t:")) != -1) {
+        switch (opt) {
+        case 'q': Serial.enabled = false; break;
+        case 'i': interrupt = true; break;
+        case 'm': macfilter = true; break;
+        case 'p': pool = true; break;
+        case 'c': maxclock = strtoul(optarg, NULL, 0); break;
+        case 'w': wedge = atoi(optarg); break;
+        case 'n': frames = atoi(optarg); break;
+        case 't': tracefile = optarg; break;
+        default: usage();
+        }
+    }
+
+#if W5100_TRACE
+    FILE *trace = NULL;
+    if (tracefile) {
+        trace = fopen(tracefile, "wb");
+        if (!trace) {
+            perror(tracefile);
+            return -1;
+        }
+    }
+#else
+    if (tracefile) {
+        fprintf(stderr, "Tracing needs the driver to be built with W5100_TRACE=1\n");
+        return -1;
+    }
+#endif
+
+#if !W5100_POOL_FRAMES
+    if (pool) {
+        fprintf(stderr, "The frame pool needs the driver to be built with W5100_POOL_FRAMES\n");
+        return -1;
+    }
+#endif
+
+    hostsim_attach(&chip);
+    if (maxclock)
+        chip.setMaxClock(maxclock);
+    if (macfilter) {
+        w5100.clearMulticastAddresses();
+        w5100.setHardwareFilter(true);
+    }
+    setup();
+    if (interrupt)
+        w5100.enableInterrupt(chip.intPin());
+
+    for (int i = 0; i < frames; i++) {
+        uint8_t request[1514];
+        uint16_t len = 60 + (i * 97) % (sizeof(request) - 60);
+        std::vector<uint8_t> reply;
+
+        // Traffic for another host, which should be filtered out
+        make_frame(request, len, other_mac, 0x88B5, i);
+        chip.injectFrame(request, len);
+
+        // An echo request for the sketch
+        make_frame(request, len, mac_address, 0x88B5, i);
+        chip.injectFrame(request, len);
+
+        mac_filtered += chip.counters().rxFiltered;
+        chip.resetCounters();
+        if (i == wedge)
+            chip.wedge();
+        for (int j = 0; j < 4; j++) {
+#if W5100_POOL_FRAMES
+            if (pool) {
+                pool_loop();
+                continue;
+            }
+#endif
+            loop();
+        }
+
+#if W5100_TRACE
+        if (trace) {
+            FilePrint out(trace);
+            w5100.dumpTrace(out);
+        }
+#endif
+
+        const W5100Model::Counters &c = chip.counters();
+        bool ok = chip.popSentFrame(reply) && check_reply(reply, request, len, i);
+
+        fprintf(stderr, "frame=%d len=%u reply=%s transactions=%u chip_selects=%u errors=%u\n",
+                i, len, ok ? "ok" : "FAIL", c.transactions, c.chipSelects, c.errors);
+
+        if (i == wedge) {
+            // The reply to this frame is lost, but the driver must come back
+            Wiznet5100::Status status = w5100.reinit();
+            fprintf(stderr, "reinit status=%d\n", status);
+            if (status != Wiznet5100::StatusOk)
+                failures++;
+            send_count = i + 1;
+        } else if (!ok) {
+            failures++;
+        }
+    }
+
+#if W5100_TRACE
+    if (trace)
+        fclose(trace);
+#endif
+
+#if W5100_STATS
+    Wiznet5100::Stats stats;
+    w5100.getStats(stats);
+    fprintf(stderr, "rx_frames=%u rx_bytes=%u rx_filtered=%u rx_filtered_bytes=%u\n",
+            stats.rx_frames, stats.rx_bytes, stats.rx_filtered, stats.rx_filtered_bytes);
+    fprintf(stderr, "tx_frames=%u tx_bytes=%u tx_timeouts=%u tx_full_spins=%u\n",
+            stats.tx_frames, stats.tx_bytes, stats.tx_timeouts, stats.tx_full_spins);
+    fprintf(stderr, "cmd_waits=%u cmd_timeouts=%u timeouts=%u bus_transactions=%u\n",
+            stats.cmd_waits, stats.cmd_timeouts, stats.timeouts, stats.bus_transactions);
+#if W5100_POOL_FRAMES
+    fprintf(stderr, "pool_high_water=%u pool_exhausted=%u\n",
+            stats.pool_high_water, stats.pool_exhausted);
+#endif
+#endif
+
+    fprintf(stderr, "mac_filtered=%u filtered_frames=%u filtered_bytes=%u spi_clock=%u\n",
+            mac_filtered, w5100.filteredFrames(), w5100.filteredBytes(), w5100.spiClock());
+    fprintf(stderr, "log_pending=%u log_dropped=%u\n", frameLog.pending(), frameLog.dropped());
+    fprintf(stderr, "%d of %d replies failed\n", failures, frames);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Linux programme that runs UDP on socket 1 alongside raw frames on socket 0
+ *
+ * Echoes raw frames on socket 0 with readFrame() and sendFrame(), while
+ * WiznetUdp echoes datagrams on socket 1, and checks both sets of replies.
+ * It is built with the memory split between the sockets (W5100_RMSR and
+ * W5100_TMSR).
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "w5100.h"
+#include "w5100_udp.h"
+#include "w5100_model.h"
+
+
+static const uint8_t our_mac[6] = {0xae, 0x03, 0xf3, 0xc7, 0x08, 0x78};
+static const uint8_t their_mac[6] = {0x1e, 0x65, 0x55, 0x3c, 0x84, 0xc3};
+static const uint8_t our_ip[4] = {192, 168, 0, 10};
+static const uint8_t their_ip[4] = {192, 168, 0, 2};
+static const uint8_t subnet_mask[4] = {255, 255, 255, 0};
+static const uint16_t our_port = 5000;
+static const uint16_t their_port = 6000;
+
+
+static void make_payload(uint8_t *data, uint16_t len, uint8_t counter)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = (i + counter) & 0xFF;
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: simudp [-5] [-n count]\n");
+    fprintf(stderr, "  -5         Talk to the model as a W5500\n");
+    fprintf(stderr, "  -n count   Number of frames and datagrams to echo (default 20)\n");
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool w5500 = false;
+    int count = 20;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "5n:")) != -1) {
+        switch (opt) {
+        case '5': w5500 = true; break;
+        case 'n': count = atoi(optarg); break;
+        default: usage();
+        }
+    }
+
+    W5100Model chip(10, 2, w5500 ? W5100Model::W5500 : W5100Model::W5100);
+    WiznetW5500Bus w5500_bus;
+    WiznetSpiBus spi_bus;
+    Wiznet5100 w5100_spi(spi_bus);
+    Wiznet5100 w5100_w5500(w5500_bus);
+    Wiznet5100 &driver = w5500 ? w5100_w5500 : w5100_spi;
+    WiznetUdp<1> udp(driver);
+    uint8_t ip[4];
+
+    hostsim_attach(&chip);
+    driver.setIPAddress(our_ip);
+    driver.setSubnetMask(subnet_mask);
+    if (!driver.begin(our_mac)) {
+        fprintf(stderr, "Failed to set up the Ethernet controller\n");
+        return -1;
+    }
+    chip.ipAddress(ip);
+    if (memcmp(ip, our_ip, 4) != 0) {
+        fprintf(stderr, "The IP address wasn't set\n");
+        return -1;
+    }
+    Wiznet5100::Status status = udp.begin(our_port);
+    if (status != Wiznet5100::StatusOk) {
+        fprintf(stderr, "Failed to open the UDP socket: status=%d\n", status);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t frame[1514], payload[1024], buf[1514];
+        uint16_t frame_len = 60 + (i * 97) % (sizeof(frame) - 60);
+        uint16_t payload_len = 1 + (i * 61) % sizeof(payload);
+        std::vector<uint8_t> reply;
+        W5100Model::Datagram datagram;
+        uint8_t from[4];
+        uint16_t port = 0;
+        bool frame_ok, udp_ok;
+
+        // A raw frame for socket 0 and a datagram for socket 1, arriving together
+        memcpy(&frame[0], our_mac, 6);
+        memcpy(&frame[6], their_mac, 6);
+        frame[12] = 0x88;
+        frame[13] = 0xB5;
+        make_payload(&frame[14], frame_len - 14, i);
+        chip.injectFrame(frame, frame_len);
+        make_payload(payload, payload_len, i);
+        chip.injectDatagram(our_port, their_ip, their_port, payload, payload_len);
+        chip.resetCounters();
+
+        // Send each back where it came from
+        uint16_t len = driver.readFrame(buf, sizeof(buf));
+        if (len > 0) {
+            memcpy(&buf[0], &buf[6], 6);
+            memcpy(&buf[6], our_mac, 6);
+            driver.sendFrame(buf, len);
+        }
+        len = udp.receive(buf, sizeof(buf), from, &port);
+        if (len > 0) {
+            status = udp.sendTo(from, port, buf, len);
+            if (status != Wiznet5100::StatusOk)
+                fprintf(stderr, "sendTo failed: status=%d\n", status);
+        }
+
+        frame_ok = chip.popSentFrame(reply) && reply.size() == frame_len &&
+                   memcmp(&reply[0], their_mac, 6) == 0 &&
+                   memcmp(&reply[14], &frame[14], frame_len - 14) == 0;
+        udp_ok = chip.popSentDatagram(datagram) && datagram.socket == 1 &&
+                 memcmp(datagram.address, their_ip, 4) == 0 && datagram.port == their_port &&
+                 datagram.data.size() == payload_len &&
+                 memcmp(&datagram.data[0], payload, payload_len) == 0;
+        if (!frame_ok || !udp_ok)
+            failures++;
+
+        const W5100Model::Counters &c = chip.counters();
+        fprintf(stderr, "exchange=%d frame_len=%u frame=%s payload_len=%u datagram=%s transactions=%u chip_selects=%u errors=%u\n",
+                i, frame_len, frame_ok ? "ok" : "FAIL", payload_len, udp_ok ? "ok" : "FAIL",
+                c.transactions, c.chipSelects, c.errors);
+    }
+
+    udp.end();
+    driver.end();
+
+    fprintf(stderr, "%d of %d exchanges failed\n", failures, count);
+    return failures ? 1 : 0;
+}
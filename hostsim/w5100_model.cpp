@@ -0,0 +1,746 @@
+/*
+ * Software model of the WIZnet W5100, for testing the driver on a Linux host
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_model.h"
+
+#include <string.h>
+
+
+/** Common registers */
+enum {
+    MR = 0x0000,
+    SHAR = 0x0009,
+    SIPR = 0x000F,
+    IR = 0x0015,
+    IMR = 0x0016,
+    RTR = 0x0017,
+    RCR = 0x0019,
+    RMSR = 0x001A,
+    TMSR = 0x001B,
+};
+
+/** Socket register offsets */
+enum {
+    Sn_MR = 0x00,
+    Sn_CR = 0x01,
+    Sn_IR = 0x02,
+    Sn_SR = 0x03,
+    Sn_PORT = 0x04,
+    Sn_DIPR = 0x0C,
+    Sn_DPORT = 0x10,
+    Sn_TX_FSR = 0x20,
+    Sn_TX_RD = 0x22,
+    Sn_TX_WR = 0x24,
+    Sn_RX_RSR = 0x26,
+    Sn_RX_RD = 0x28,
+    Sn_RX_WR = 0x2A,
+};
+
+enum {
+    MR_RST = 0x80,
+};
+
+enum {
+    Sn_MR_CLOSE = 0x00,
+    Sn_MR_TCP = 0x01,
+    Sn_MR_UDP = 0x02,
+    Sn_MR_IPRAW = 0x03,
+    Sn_MR_MACRAW = 0x04,
+    Sn_MR_MF = 0x40,
+};
+
+enum {
+    Sn_CR_OPEN = 0x01,
+    Sn_CR_CLOSE = 0x10,
+    Sn_CR_SEND = 0x20,
+    Sn_CR_RECV = 0x40,
+};
+
+enum {
+    Sn_IR_RECV = 0x04,
+    Sn_IR_SENDOK = 0x10,
+};
+
+enum {
+    SOCK_CLOSED = 0x00,
+    SOCK_INIT = 0x13,
+    SOCK_UDP = 0x22,
+    SOCK_IPRAW = 0x32,
+    SOCK_MACRAW = 0x42,
+};
+
+enum {
+    OP_WRITE = 0xF0,
+    OP_READ = 0x0F,
+};
+
+
+/** W5500 registers that differ from the W5100 */
+enum {
+    W5500_IR = 0x0015,
+    W5500_IMR = 0x0016,
+    W5500_SIR = 0x0017,
+    W5500_SIMR = 0x0018,
+    W5500_RTR = 0x0019,
+    W5500_RCR = 0x001B,
+    W5500_VERSIONR = 0x0039,
+    W5500_Sn_RXBUF_SIZE = 0x1E,
+    W5500_Sn_TXBUF_SIZE = 0x1F,
+    W5500_Sn_MR_MFEN = 0x80,
+    W5500_CONTROL_WRITE = 0x04,
+    W5500_CONTROL_MODE = 0x03,
+};
+
+
+W5100Model::W5100Model(uint8_t csPin, uint8_t intPin, Family family)
+{
+    _cs_pin = csPin;
+    _int_pin = intPin;
+    _family = family;
+    _send_delay = 0;
+    _max_clock = 0;
+    _selected = false;
+    _frame_pos = 0;
+    _burst_pos = 0;
+    _int_level = false;
+    resetCounters();
+    reset();
+}
+
+void W5100Model::reset()
+{
+    memset(_mem, 0, sizeof(_mem));
+    _wedged = false;
+    setWord(RTR, 0x07D0);
+    _mem[RCR] = 0x08;
+    _mem[RMSR] = 0x55;
+    _mem[TMSR] = 0x55;
+
+    for (uint8_t sn = 0; sn < Sockets; sn++) {
+        _rx_rd[sn] = 0;
+        _sending[sn] = false;
+        _send_done[sn] = 0;
+    }
+
+    updateInterrupt();
+}
+
+void W5100Model::resetCounters()
+{
+    memset(&_counters, 0, sizeof(_counters));
+}
+
+uint16_t W5100Model::socketAddress(uint8_t sn, uint8_t offset) const
+{
+    return SocketRegisters + (sn << 8) + offset;
+}
+
+uint16_t W5100Model::word(uint16_t address) const
+{
+    return ((uint16_t)_mem[address] << 8) | _mem[address + 1];
+}
+
+void W5100Model::setWord(uint16_t address, uint16_t value)
+{
+    _mem[address] = value >> 8;
+    _mem[address + 1] = value & 0xFF;
+}
+
+uint16_t W5100Model::rxBase(uint8_t sn) const
+{
+    uint16_t base = RxMemory;
+    for (uint8_t i = 0; i < sn; i++)
+        base += rxSize(i);
+    return base;
+}
+
+uint16_t W5100Model::rxSize(uint8_t sn) const
+{
+    uint32_t base = RxMemory;
+    uint16_t size = 0;
+
+    // Memory is given to each socket in turn, until it runs out
+    for (uint8_t i = 0; i <= sn; i++) {
+        base += size;
+        size = 1024 << ((_mem[RMSR] >> (2 * i)) & 0x03);
+    }
+    return (base + size <= MemorySize) ? size : 0;
+}
+
+uint16_t W5100Model::txBase(uint8_t sn) const
+{
+    uint16_t base = TxMemory;
+    for (uint8_t i = 0; i < sn; i++)
+        base += txSize(i);
+    return base;
+}
+
+uint16_t W5100Model::txSize(uint8_t sn) const
+{
+    uint32_t base = TxMemory;
+    uint16_t size = 0;
+
+    for (uint8_t i = 0; i <= sn; i++) {
+        base += size;
+        size = 1024 << ((_mem[TMSR] >> (2 * i)) & 0x03);
+    }
+    return (base + size <= RxMemory) ? size : 0;
+}
+
+void W5100Model::select(bool selected)
+{
+    if (selected && !_selected) {
+        _counters.chipSelects++;
+        _frame_pos = 0;
+        _burst_pos = 0;
+    } else if (!selected && _selected) {
+        if (_family == W5500) {
+            // A W5500 burst needs at least one data byte
+            if (_burst_pos != 0 && _burst_pos < 4)
+                _counters.errors++;
+        } else if (_frame_pos != 0 && _frame_pos != sizeof(_frame)) {
+            // Chip deselected part way through a frame
+            _counters.errors++;
+        }
+    }
+
+    _selected = selected;
+}
+
+uint8_t W5100Model::transfer(uint8_t mosi, uint32_t clock)
+{
+    uint8_t miso = transferByte(mosi);
+
+    if (_selected && _max_clock && clock > _max_clock) {
+        // Too fast for the wiring: the chip's reply gets garbled
+        _counters.clockErrors++;
+        miso ^= 0x01;
+    }
+    return miso;
+}
+
+uint8_t W5100Model::transferByte(uint8_t mosi)
+{
+    if (!_selected)
+        return 0x00;
+
+    _counters.spiBytes++;
+    if (_family == W5500)
+        return transferW5500(mosi);
+
+    if (_frame_pos >= sizeof(_frame)) {
+        // Each frame needs its own chip select cycle
+        _counters.errors++;
+        return 0x00;
+    }
+
+    _frame[_frame_pos] = mosi;
+    if (++_frame_pos < sizeof(_frame)) {
+        // The chip echoes 0x00, 0x01, 0x02 during the header
+        return _frame_pos - 1;
+    }
+
+    uint16_t address = ((uint16_t)_frame[1] << 8) | _frame[2];
+    if (_frame[0] == OP_WRITE) {
+        _counters.transactions++;
+        _counters.writes++;
+        writeRegister(address, _frame[3]);
+        return 0x03;
+    } else if (_frame[0] == OP_READ) {
+        _counters.transactions++;
+        _counters.reads++;
+        return readRegister(address);
+    } else {
+        _counters.errors++;
+        return 0x00;
+    }
+}
+
+uint8_t W5100Model::transferW5500(uint8_t mosi)
+{
+    if (_burst_pos < 3) {
+        // Address, then the control byte
+        _frame[_burst_pos++] = mosi;
+        if (_burst_pos == 3) {
+            _counters.transactions++;
+            if (_frame[2] & W5500_CONTROL_WRITE)
+                _counters.writes++;
+            else
+                _counters.reads++;
+            if (_frame[2] & W5500_CONTROL_MODE) {
+                // Only variable length data is modelled
+                _counters.errors++;
+            }
+        }
+        return 0x00;
+    }
+
+    uint16_t address = (((uint16_t)_frame[0] << 8) | _frame[1]) + (_burst_pos++ - 3);
+    uint8_t block = _frame[2] >> 3;
+    if (_frame[2] & W5500_CONTROL_WRITE) {
+        writeW5500(block, address, mosi);
+        return 0x00;
+    } else {
+        return readW5500(block, address);
+    }
+}
+
+int32_t W5100Model::mapW5500(uint8_t block, uint16_t address) const
+{
+    uint8_t sn = block >> 2;
+
+    if (block == 0) {
+        // Common registers: the addresses and MR are unchanged, RTR and RCR have moved
+        if (address < IR)
+            return address;
+        if (address >= W5500_RTR && address <= W5500_RCR)
+            return address - (W5500_RTR - RTR);
+        return -1;
+    }
+
+    if (sn >= Sockets)
+        return -1;
+
+    switch (block & 0x03) {
+    case 1:
+        return address < 0x30 ? socketAddress(sn, address) : -1;
+    case 2:
+        return txSize(sn) ? txBase(sn) + (address & (txSize(sn) - 1)) : -1;
+    case 3:
+        return rxSize(sn) ? rxBase(sn) + (address & (rxSize(sn) - 1)) : -1;
+    }
+    return -1;
+}
+
+uint8_t W5100Model::readW5500(uint8_t block, uint16_t address)
+{
+    if (block == 0) {
+        switch (address) {
+        case W5500_IR: return _mem[IR] & 0xE0;
+        case W5500_IMR: return _mem[IMR] & 0xE0;
+        case W5500_SIR: return readRegister(IR) & 0x0F;
+        case W5500_SIMR: return _mem[IMR] & 0x0F;
+        case W5500_VERSIONR: return 0x04;
+        }
+    } else if ((block & 0x03) == 1 && (block >> 2) < Sockets) {
+        uint8_t sn = block >> 2;
+        uint8_t mr;
+
+        switch (address) {
+        case W5500_Sn_RXBUF_SIZE: return rxSize(sn) >> 10;
+        case W5500_Sn_TXBUF_SIZE: return txSize(sn) >> 10;
+        case Sn_MR:
+            mr = readRegister(socketAddress(sn, Sn_MR));
+            if ((mr & 0x0F) == Sn_MR_MACRAW && (mr & Sn_MR_MF))
+                mr = (mr & ~Sn_MR_MF) | W5500_Sn_MR_MFEN;
+            return mr;
+        }
+    }
+
+    int32_t mapped = mapW5500(block, address);
+    return mapped < 0 ? 0x00 : readRegister(mapped);
+}
+
+void W5100Model::writeW5500(uint8_t block, uint16_t address, uint8_t value)
+{
+    if (block == 0) {
+        switch (address) {
+        case W5500_IR:
+            writeRegister(IR, value & 0xE0);
+            return;
+        case W5500_IMR:
+            writeRegister(IMR, (_mem[IMR] & 0x0F) | (value & 0xE0));
+            return;
+        case W5500_SIMR:
+            writeRegister(IMR, (_mem[IMR] & 0xE0) | (value & 0x0F));
+            return;
+        }
+    } else if ((block & 0x03) == 1 && (block >> 2) < Sockets) {
+        uint8_t sn = block >> 2;
+
+        switch (address) {
+        case W5500_Sn_RXBUF_SIZE:
+            setBufferSize(RMSR, sn, value);
+            return;
+        case W5500_Sn_TXBUF_SIZE:
+            setBufferSize(TMSR, sn, value);
+            return;
+        case Sn_MR:
+            if ((value & 0x0F) == Sn_MR_MACRAW && (value & W5500_Sn_MR_MFEN))
+                value = (value & 0x0F) | Sn_MR_MF;
+            break;
+        }
+    }
+
+    int32_t mapped = mapW5500(block, address);
+    if (mapped >= 0)
+        writeRegister(mapped, value);
+}
+
+void W5100Model::setBufferSize(uint16_t msr, uint8_t sn, uint8_t kb)
+{
+    uint8_t code;
+
+    switch (kb) {
+    case 0:
+        // Sockets without memory are left to run out, as on the W5100
+        return;
+    case 1: code = 0; break;
+    case 2: code = 1; break;
+    case 4: code = 2; break;
+    case 8: code = 3; break;
+    default:
+        // 16kB buffers don't fit in the W5100 memory map
+        _counters.errors++;
+        return;
+    }
+
+    _mem[msr] = (_mem[msr] & ~(0x03 << (2 * sn))) | (code << (2 * sn));
+}
+
+uint8_t W5100Model::peek(uint16_t address)
+{
+    return readRegister(address);
+}
+
+void W5100Model::poke(uint16_t address, uint8_t value)
+{
+    writeRegister(address, value);
+}
+
+uint8_t W5100Model::readRegister(uint16_t address)
+{
+    address &= (MemorySize - 1);
+    update();
+
+    if (address >= SocketRegisters && address < socketAddress(Sockets, 0)) {
+        uint8_t sn = (address - SocketRegisters) >> 8;
+        uint8_t offset = address & 0xFF;
+        uint16_t value;
+
+        switch (offset & ~1) {
+        case Sn_CR & ~1:
+            // Commands complete immediately, unless the chip has locked up
+            if (offset == Sn_CR)
+                return _wedged ? _mem[address] : 0x00;
+            break;
+        case Sn_TX_FSR:
+            value = txSize(sn) - (uint16_t)(word(socketAddress(sn, Sn_TX_WR)) - word(socketAddress(sn, Sn_TX_RD)));
+            return (offset & 1) ? (value & 0xFF) : (value >> 8);
+        case Sn_RX_RSR:
+            value = word(socketAddress(sn, Sn_RX_WR)) - _rx_rd[sn];
+            return (offset & 1) ? (value & 0xFF) : (value >> 8);
+        }
+    } else if (address == IR) {
+        uint8_t ir = _mem[IR] & 0xE0;
+        for (uint8_t sn = 0; sn < Sockets; sn++) {
+            if (_mem[socketAddress(sn, Sn_IR)])
+                ir |= (1 << sn);
+        }
+        return ir;
+    }
+
+    return _mem[address];
+}
+
+void W5100Model::writeRegister(uint16_t address, uint8_t value)
+{
+    address &= (MemorySize - 1);
+    update();
+
+    if (address == MR) {
+        if (value & MR_RST) {
+            reset();
+        } else {
+            _mem[MR] = value;
+        }
+        return;
+    } else if (address == IR) {
+        // Write 1 to clear
+        _mem[IR] &= ~(value & 0xE0);
+        return;
+    } else if (address == IMR) {
+        _mem[IMR] = value;
+        updateInterrupt();
+        return;
+    } else if (address >= SocketRegisters && address < socketAddress(Sockets, 0)) {
+        uint8_t sn = (address - SocketRegisters) >> 8;
+        uint8_t offset = address & 0xFF;
+
+        switch (offset) {
+        case Sn_CR:
+            if (_wedged) {
+                _mem[address] = value;
+                return;
+            }
+            command(sn, value);
+            return;
+        case Sn_IR:
+            // Write 1 to clear
+            _mem[address] &= ~value;
+            updateInterrupt();
+            return;
+        case Sn_SR:
+        case Sn_TX_FSR: case Sn_TX_FSR + 1:
+        case Sn_TX_RD: case Sn_TX_RD + 1:
+        case Sn_RX_RSR: case Sn_RX_RSR + 1:
+        case Sn_RX_WR: case Sn_RX_WR + 1:
+            // Read only
+            return;
+        }
+    }
+
+    _mem[address] = value;
+}
+
+void W5100Model::command(uint8_t sn, uint8_t cr)
+{
+    uint16_t sr = socketAddress(sn, Sn_SR);
+
+    switch (cr) {
+    case Sn_CR_OPEN:
+        switch (_mem[socketAddress(sn, Sn_MR)] & 0x0F) {
+        case Sn_MR_TCP: _mem[sr] = SOCK_INIT; break;
+        case Sn_MR_UDP: _mem[sr] = SOCK_UDP; break;
+        case Sn_MR_IPRAW: _mem[sr] = SOCK_IPRAW; break;
+        case Sn_MR_MACRAW:
+            if (sn == 0) {
+                _mem[sr] = SOCK_MACRAW;
+                break;
+            }
+            // Only socket 0 supports MACRAW
+            // fall through
+        default:
+            _counters.errors++;
+            return;
+        }
+        setWord(socketAddress(sn, Sn_TX_RD), 0);
+        setWord(socketAddress(sn, Sn_TX_WR), 0);
+        setWord(socketAddress(sn, Sn_RX_RD), 0);
+        setWord(socketAddress(sn, Sn_RX_WR), 0);
+        _mem[socketAddress(sn, Sn_IR)] = 0;
+        _rx_rd[sn] = 0;
+        _sending[sn] = false;
+        break;
+
+    case Sn_CR_CLOSE:
+        _mem[sr] = SOCK_CLOSED;
+        _sending[sn] = false;
+        break;
+
+    case Sn_CR_SEND:
+        if (_mem[sr] == SOCK_CLOSED || _sending[sn]) {
+            _counters.errors++;
+            return;
+        }
+        _sending[sn] = true;
+        _send_done[sn] = hostsim_now() + _send_delay;
+        if (_send_delay == 0)
+            completeSend(sn);
+        break;
+
+    case Sn_CR_RECV:
+        _rx_rd[sn] = word(socketAddress(sn, Sn_RX_RD));
+        break;
+
+    default:
+        _counters.errors++;
+        break;
+    }
+}
+
+void W5100Model::completeSend(uint8_t sn)
+{
+    uint16_t rd = word(socketAddress(sn, Sn_TX_RD));
+    uint16_t wr = word(socketAddress(sn, Sn_TX_WR));
+    uint16_t base = txBase(sn);
+    uint16_t mask = txSize(sn) - 1;
+    std::vector<uint8_t> frame;
+
+    for (uint16_t ptr = rd; ptr != wr; ptr++) {
+        frame.push_back(_mem[base + (ptr & mask)]);
+    }
+
+    if (_mem[socketAddress(sn, Sn_SR)] == SOCK_UDP) {
+        // The chip adds the headers, so just keep where it went
+        Datagram datagram;
+        datagram.socket = sn;
+        memcpy(datagram.address, &_mem[socketAddress(sn, Sn_DIPR)], 4);
+        datagram.port = word(socketAddress(sn, Sn_DPORT));
+        datagram.data = frame;
+        _datagrams.push_back(datagram);
+    } else {
+        _sent.push_back(frame);
+    }
+
+    setWord(socketAddress(sn, Sn_TX_RD), wr);
+    _sending[sn] = false;
+    setInterrupt(sn, Sn_IR_SENDOK);
+}
+
+void W5100Model::update()
+{
+    for (uint8_t sn = 0; sn < Sockets; sn++) {
+        if (_sending[sn] && (long)(hostsim_now() - _send_done[sn]) >= 0)
+            completeSend(sn);
+    }
+}
+
+bool W5100Model::injectFrame(const uint8_t *data, uint16_t len)
+{
+    uint16_t wr = word(socketAddress(0, Sn_RX_WR));
+    uint16_t base = rxBase(0);
+    uint16_t size = rxSize(0);
+    uint16_t total = len + 2;
+
+    if (_mem[socketAddress(0, Sn_SR)] != SOCK_MACRAW)
+        return false;
+
+    // The MAC filter only lets through frames for SHAR and broadcast
+    if (_mem[socketAddress(0, Sn_MR)] & Sn_MR_MF) {
+        static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        if (len < 6 || (memcmp(data, &_mem[SHAR], 6) != 0 && memcmp(data, broadcast, 6) != 0)) {
+            _counters.rxFiltered++;
+            return true;
+        }
+    }
+
+    if (total > size - (uint16_t)(wr - _rx_rd[0])) {
+        _counters.rxDropped++;
+        return false;
+    }
+
+    // MACRAW frames start with their length, including the 2 length bytes
+    _mem[base + (wr++ & (size - 1))] = total >> 8;
+    _mem[base + (wr++ & (size - 1))] = total & 0xFF;
+    for (uint16_t i = 0; i < len; i++) {
+        _mem[base + (wr++ & (size - 1))] = data[i];
+    }
+    setWord(socketAddress(0, Sn_RX_WR), wr);
+
+    setInterrupt(0, Sn_IR_RECV);
+    return true;
+}
+
+bool W5100Model::injectDatagram(uint16_t port, const uint8_t *address, uint16_t from,
+                                const uint8_t *data, uint16_t len)
+{
+    uint8_t sn;
+
+    // Find the UDP socket that is bound to the port
+    for (sn = 0; sn < Sockets; sn++) {
+        if (_mem[socketAddress(sn, Sn_SR)] == SOCK_UDP && word(socketAddress(sn, Sn_PORT)) == port)
+            break;
+    }
+    if (sn == Sockets)
+        return false;
+
+    uint16_t wr = word(socketAddress(sn, Sn_RX_WR));
+    uint16_t base = rxBase(sn);
+    uint16_t size = rxSize(sn);
+    uint8_t header[8];
+    uint16_t total = len + sizeof(header);
+
+    if (total > size - (uint16_t)(wr - _rx_rd[sn])) {
+        _counters.rxDropped++;
+        return false;
+    }
+
+    // UDP datagrams start with the sender's address and port, and the length
+    memcpy(header, address, 4);
+    header[4] = from >> 8;
+    header[5] = from & 0xFF;
+    header[6] = len >> 8;
+    header[7] = len & 0xFF;
+    for (uint16_t i = 0; i < sizeof(header); i++) {
+        _mem[base + (wr++ & (size - 1))] = header[i];
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        _mem[base + (wr++ & (size - 1))] = data[i];
+    }
+    setWord(socketAddress(sn, Sn_RX_WR), wr);
+
+    setInterrupt(sn, Sn_IR_RECV);
+    return true;
+}
+
+bool W5100Model::popSentDatagram(Datagram &datagram)
+{
+    if (_datagrams.empty())
+        return false;
+
+    datagram = _datagrams.front();
+    _datagrams.pop_front();
+    return true;
+}
+
+void W5100Model::ipAddress(uint8_t *address) const
+{
+    memcpy(address, &_mem[SIPR], 4);
+}
+
+bool W5100Model::popSentFrame(std::vector<uint8_t> &frame)
+{
+    if (_sent.empty())
+        return false;
+
+    frame = _sent.front();
+    _sent.pop_front();
+    return true;
+}
+
+void W5100Model::setInterrupt(uint8_t sn, uint8_t bits)
+{
+    _mem[socketAddress(sn, Sn_IR)] |= bits;
+    updateInterrupt();
+}
+
+bool W5100Model::interruptAsserted() const
+{
+    for (uint8_t sn = 0; sn < Sockets; sn++) {
+        if ((_mem[IMR] & (1 << sn)) && _mem[socketAddress(sn, Sn_IR)])
+            return true;
+    }
+    return false;
+}
+
+void W5100Model::updateInterrupt()
+{
+    bool level = interruptAsserted();
+
+    // The pin is active low, so an interrupt is a falling edge
+    if (level && !_int_level)
+        hostsim_interrupt(_int_pin);
+
+    _int_level = level;
+}
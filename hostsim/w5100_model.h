@@ -0,0 +1,285 @@
+/*
+ * Software model of the WIZnet W5100, for testing the driver on a Linux host
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_MODEL_H
+#define	W5100_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+
+/**
+ * Software model of a W5100, as seen through its SPI interface
+ *
+ * It decodes the 4-byte 0xF0 (write) and 0x0F (read) SPI frames, implements the
+ * common registers and the socket registers, the RX and TX buffer memory with
+ * pointer wrap, and the OPEN, CLOSE, SEND and RECV commands.
+ * Sockets in MACRAW mode receive frames with the 2-byte length prefix,
+ * and sockets in UDP mode send and receive datagrams with their addresses.
+ *
+ * It can also speak the W5500 SPI protocol, where each chip select carries a
+ * 2-byte address, a block select byte and then any number of data bytes.
+ * The W5500 blocks are mapped onto the same registers and memory.
+ *
+ * Every SPI frame and chip select cycle is counted, so that changes to the
+ * driver can be checked for the amount of bus traffic they cause.
+ */
+class W5100Model {
+
+public:
+    /** The SPI protocol to decode */
+    enum Family {
+        W5100,      ///< 4-byte frames, one for each byte
+        W5500,      ///< Address and block select, then a burst of data
+    };
+
+    /** Bus traffic and error counters */
+    struct Counters {
+        uint32_t transactions;  ///< Complete 4-byte SPI frames, or W5500 bursts
+        uint32_t reads;         ///< Read frames or bursts
+        uint32_t writes;        ///< Write frames or bursts
+        uint32_t chipSelects;   ///< Chip select cycles
+        uint32_t spiBytes;      ///< Bytes transferred while selected
+        uint32_t errors;        ///< Bad opcodes, incomplete frames and invalid commands
+        uint32_t rxDropped;     ///< Frames dropped because the RX buffer was full
+        uint32_t rxFiltered;    ///< Frames dropped by the MAC filter (Sn_MR_MF)
+        uint32_t clockErrors;   ///< Bytes corrupted because the SPI clock was too fast
+    };
+
+    /** A datagram sent by a UDP socket */
+    struct Datagram {
+        uint8_t socket;             ///< The socket that sent it
+        uint8_t address[4];         ///< Destination IP address
+        uint16_t port;              ///< Destination UDP port
+        std::vector<uint8_t> data;  ///< The payload
+    };
+
+    /**
+     * @param csPin the Arduino pin the driver uses for chip select
+     * @param intPin the Arduino pin that INT is connected to
+     * @param family the SPI protocol to decode
+     */
+    W5100Model(uint8_t csPin = 10, uint8_t intPin = 2, Family family = W5100);
+
+    /**
+     * Reset all registers, as if the chip had been powered up
+     */
+    void reset();
+
+    /**
+     * Set how long a SEND command takes to complete
+     * @param micros the delay in microseconds, or 0 to complete immediately
+     */
+    void setSendDelay(uint32_t micros) { _send_delay = micros; }
+
+    uint8_t csPin() const { return _cs_pin; }
+    uint8_t intPin() const { return _int_pin; }
+
+    /**
+     * Change the state of the chip select line
+     * @param selected true when the line is low
+     */
+    void select(bool selected);
+
+    /**
+     * Make the chip stop completing socket commands, until it is reset
+     * Commands written to Sn_CR are not carried out, and Sn_CR keeps reading back
+     * the command, as on a chip that has locked up.
+     */
+    void wedge() { _wedged = true; }
+
+    /**
+     * Set the fastest SPI clock that works, to test clock calibration
+     * Bytes read from the chip at a faster clock have a bit flipped.
+     * @param clock the clock in Hz, or 0 for no limit
+     */
+    void setMaxClock(uint32_t clock) { _max_clock = clock; }
+
+    /**
+     * Exchange a byte on the SPI bus
+     * @param mosi the byte sent to the chip
+     * @param clock the SPI clock in Hz, or 0 if not known
+     * @return the byte sent back by the chip
+     */
+    uint8_t transfer(uint8_t mosi, uint32_t clock = 0);
+
+    /**
+     * Receive a frame from the network on socket 0
+     * @param data the Ethernet frame
+     * @param len the length of the frame
+     * @return false if the socket is not open in MACRAW mode or its RX buffer is full
+     */
+    bool injectFrame(const uint8_t *data, uint16_t len);
+
+    /**
+     * Receive a UDP datagram from the network
+     * @param port the destination port, which a socket must be open in UDP mode on
+     * @param address the 4-byte IP address of the sender
+     * @param from the UDP port of the sender
+     * @param data the payload
+     * @param len the length of the payload
+     * @return false if no socket is open on the port or its RX buffer is full
+     */
+    bool injectDatagram(uint16_t port, const uint8_t *address, uint16_t from,
+                        const uint8_t *data, uint16_t len);
+
+    /**
+     * Get the next datagram that was sent by a UDP socket
+     * @param datagram set to the datagram
+     * @return false if there are no more sent datagrams
+     */
+    bool popSentDatagram(Datagram &datagram);
+
+    /**
+     * Get the IP address that the driver gave the chip
+     * @param address set to the 4-byte address
+     */
+    void ipAddress(uint8_t *address) const;
+
+    /**
+     * Get the next frame that was transmitted
+     * @param frame set to the contents of the frame
+     * @return false if there are no more transmitted frames
+     */
+    bool popSentFrame(std::vector<uint8_t> &frame);
+
+    /**
+     * Get the number of frames that were transmitted and not collected yet
+     */
+    size_t sentFrames() const { return _sent.size(); }
+
+    /**
+     * Complete any SEND command whose delay has passed
+     */
+    void update();
+
+    /**
+     * Check the level of the INT pin
+     * @return true if an interrupt is being signalled (INT is low)
+     */
+    bool interruptAsserted() const;
+
+    /**
+     * Read and write the chip memory directly, without counting bus traffic
+     */
+    uint8_t peek(uint16_t address);
+    void poke(uint16_t address, uint8_t value);
+
+    const Counters &counters() const { return _counters; }
+    void resetCounters();
+
+private:
+    static const uint16_t MemorySize = 0x8000;
+    static const uint16_t TxMemory = 0x4000;
+    static const uint16_t RxMemory = 0x6000;
+    static const uint16_t SocketRegisters = 0x0400;
+    static const uint8_t Sockets = 4;
+
+    uint8_t _cs_pin;
+    uint8_t _int_pin;
+    Family _family;
+    uint32_t _send_delay;
+    uint32_t _max_clock;
+    bool _wedged;
+
+    uint8_t _mem[MemorySize];
+    uint16_t _rx_rd[Sockets];       /* Rx read pointer as of the last RECV command */
+    bool _sending[Sockets];
+    unsigned long _send_done[Sockets];
+
+    bool _selected;
+    uint8_t _frame[4];
+    uint8_t _frame_pos;
+    uint16_t _burst_pos;            /* Bytes transferred since chip select, for the W5500 */
+    bool _int_level;
+
+    std::deque< std::vector<uint8_t> > _sent;
+    std::deque<Datagram> _datagrams;
+    Counters _counters;
+
+    uint16_t socketAddress(uint8_t sn, uint8_t offset) const;
+    uint16_t word(uint16_t address) const;
+    void setWord(uint16_t address, uint16_t value);
+
+    uint16_t rxBase(uint8_t sn) const;
+    uint16_t rxSize(uint8_t sn) const;
+    uint16_t txBase(uint8_t sn) const;
+    uint16_t txSize(uint8_t sn) const;
+
+    uint8_t transferByte(uint8_t mosi);
+    uint8_t transferW5500(uint8_t mosi);
+
+    /**
+     * Find the W5100 address of a W5500 register or buffer byte
+     * @return the address, or -1 if it has no W5100 equivalent
+     */
+    int32_t mapW5500(uint8_t block, uint16_t address) const;
+    uint8_t readW5500(uint8_t block, uint16_t address);
+    void writeW5500(uint8_t block, uint16_t address, uint8_t value);
+    void setBufferSize(uint16_t msr, uint8_t sn, uint8_t kb);
+
+    uint8_t readRegister(uint16_t address);
+    void writeRegister(uint16_t address, uint8_t value);
+    void command(uint8_t sn, uint8_t cr);
+    void completeSend(uint8_t sn);
+    void setInterrupt(uint8_t sn, uint8_t bits);
+    void updateInterrupt();
+};
+
+
+/**
+ * Connect the simulated chip to the SPI and digitalWrite() functions
+ * @param model the chip, or NULL to disconnect it
+ */
+void hostsim_attach(W5100Model *model);
+
+/**
+ * Get the chip that is connected
+ */
+W5100Model *hostsim_model();
+
+/**
+ * Get the simulated time, without advancing it
+ * @return the time in microseconds
+ */
+unsigned long hostsim_now();
+
+/**
+ * Call the handler attached to an interrupt pin
+ * @param pin the pin that has a falling edge
+ */
+void hostsim_interrupt(uint8_t pin);
+
+#endif // W5100_MODEL_H
@@ -0,0 +1,130 @@
+/*
+ * Linux programme to decode the frame log written by the W5100MacRaw sketch
+ *
+ * Reads the Serial output of the sketch, from a file or from standard input,
+ * passes text straight through, and prints each binary FrameLog record as
+ * the text that the sketch used to print for every frame.
+ *
+ * Usage: logdecode [file]
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+enum {
+    LogMarker = 0xFE,
+    LogFrame = 0x01,
+    LogDropped = 0x02,
+};
+
+static void print_mac(const char *name, const uint8_t *address)
+{
+    printf("%s=%02x:%02x:%02x:%02x:%02x:%02x\n", name,
+           address[0], address[1], address[2], address[3], address[4], address[5]);
+}
+
+static int read_bytes(FILE *file, uint8_t *buf, size_t len)
+{
+    if (fread(buf, 1, len, file) != len) {
+        fprintf(stderr, "Log record is truncated\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int decode_log(FILE *file)
+{
+    int records = 0;
+    int c;
+
+    while ((c = fgetc(file)) != EOF) {
+        uint8_t record[17];
+
+        if (c != LogMarker) {
+            /* Other output from the sketch */
+            if (c != '\r')
+                putchar(c);
+            continue;
+        }
+
+        c = fgetc(file);
+        if (c == LogFrame) {
+            if (!read_bytes(file, record, 17))
+                break;
+
+            printf("Len=%u\n", record[0] | (record[1] << 8));
+            print_mac("Dest", &record[2]);
+            print_mac("Src", &record[8]);
+            /* 0x0800 = IPv4, 0x0806 = ARP, 0x86DD = IPv6 */
+            printf("Type=0x%04x\n", record[14] | (record[15] << 8));
+            printf("Byte 15=%u\n", record[16]);
+            printf("\n");
+        } else if (c == LogDropped) {
+            if (!read_bytes(file, record, 4))
+                break;
+
+            printf("Dropped %lu log records\n\n",
+                   (unsigned long)(record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24)));
+        } else {
+            fprintf(stderr, "Unknown log record type %d\n", c);
+            continue;
+        }
+        records++;
+    }
+
+    return records;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *file = stdin;
+
+    if (argc > 1) {
+        file = fopen(argv[1], "rb");
+        if (!file) {
+            perror(argv[1]);
+            exit(-1);
+        }
+    }
+
+    if (decode_log(file) == 0) {
+        fprintf(stderr, "No log records found\n");
+    }
+
+    if (file != stdin)
+        fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Linux programme to decode trace dumps from the Wiznet5100 driver
+ *
+ * Reads the binary output of Wiznet5100::dumpTrace(), from a file or from
+ * standard input, and prints the latency of each stage of sending and
+ * receiving frames.
+ *
+ * Usage: tracedump [-v] [file]
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+    TraceRxDetected = 1,
+    TraceRxHeader,
+    TraceRxPayload,
+    TraceRxCommit,
+    TraceTxStart,
+    TraceTxReserved,
+    TraceTxQueued,
+    TraceTxSend,
+    TraceTxSendOk,
+    TraceTxTimeout,
+    TraceEventCount
+};
+
+static const char *event_names[TraceEventCount] = {
+    "?", "rx-detected", "rx-header", "rx-payload", "rx-commit",
+    "tx-start", "tx-reserved", "tx-queued", "tx-send", "tx-sendok", "tx-timeout"
+};
+
+/* A stage is the time from one event to the next event of another type */
+struct stage {
+    const char *name;
+    uint8_t from;
+    uint8_t to;
+    int armed;
+    uint32_t start;
+    uint32_t *samples;
+    size_t count;
+    size_t size;
+};
+
+static struct stage stages[] = {
+    { "rx header read",      TraceRxDetected, TraceRxHeader,   0, 0, NULL, 0, 0 },
+    { "rx payload copy",     TraceRxHeader,   TraceRxPayload,  0, 0, NULL, 0, 0 },
+    { "rx recv command",     TraceRxPayload,  TraceRxCommit,   0, 0, NULL, 0, 0 },
+    { "rx total",            TraceRxDetected, TraceRxCommit,   0, 0, NULL, 0, 0 },
+    { "tx wait for space",   TraceTxStart,    TraceTxReserved, 0, 0, NULL, 0, 0 },
+    { "tx copy",             TraceTxReserved, TraceTxQueued,   0, 0, NULL, 0, 0 },
+    { "tx wait to send",     TraceTxQueued,   TraceTxSend,     0, 0, NULL, 0, 0 },
+    { "tx on the wire",      TraceTxSend,     TraceTxSendOk,   0, 0, NULL, 0, 0 },
+    { "tx total",            TraceTxStart,    TraceTxSendOk,   0, 0, NULL, 0, 0 },
+};
+
+#define STAGE_COUNT (sizeof(stages) / sizeof(stages[0]))
+
+static int verbose = 0;
+
+
+static void add_sample(struct stage *stage, uint32_t value)
+{
+    if (stage->count == stage->size) {
+        stage->size = stage->size ? stage->size * 2 : 256;
+        stage->samples = realloc(stage->samples, stage->size * sizeof(uint32_t));
+        if (!stage->samples) {
+            perror("realloc");
+            exit(-1);
+        }
+    }
+    stage->samples[stage->count++] = value;
+}
+
+static void add_event(uint32_t time, uint8_t event, uint16_t length)
+{
+    if (event == 0 || event >= TraceEventCount) {
+        fprintf(stderr, "Unknown event %d\n", event);
+        return;
+    }
+
+    if (verbose) {
+        printf("%10lu  %-12s  %u\n", (unsigned long)time, event_names[event], length);
+    }
+
+    for (size_t i = 0; i < STAGE_COUNT; i++) {
+        struct stage *stage = &stages[i];
+
+        if (stage->to == event && stage->armed) {
+            add_sample(stage, time - stage->start);
+            stage->armed = 0;
+        }
+
+        /* A stage is timed from the latest of its start events */
+        if (stage->from == event) {
+            stage->armed = 1;
+            stage->start = time;
+        }
+    }
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const struct stage *stage, int p)
+{
+    size_t i = (stage->count * p) / 100;
+    if (i >= stage->count)
+        i = stage->count - 1;
+    return stage->samples[i];
+}
+
+static void print_stages()
+{
+    printf("%-20s %8s %8s %8s %8s %8s %8s\n", "stage (us)", "count", "min", "p50", "p90", "p99", "max");
+    for (size_t i = 0; i < STAGE_COUNT; i++) {
+        struct stage *stage = &stages[i];
+        if (stage->count == 0)
+            continue;
+
+        qsort(stage->samples, stage->count, sizeof(uint32_t), compare);
+        printf("%-20s %8zu %8lu %8lu %8lu %8lu %8lu\n", stage->name, stage->count,
+               (unsigned long)stage->samples[0],
+               (unsigned long)percentile(stage, 50),
+               (unsigned long)percentile(stage, 90),
+               (unsigned long)percentile(stage, 99),
+               (unsigned long)stage->samples[stage->count - 1]);
+    }
+}
+
+static int read_dump(FILE *file)
+{
+    static const uint8_t magic[4] = {'W', '5', 'T', 'R'};
+    size_t matched = 0;
+    int dumps = 0;
+    int c;
+
+    /* Other serial output can appear between dumps, so look for the magic number */
+    while ((c = fgetc(file)) != EOF) {
+        uint8_t header[4];
+        uint16_t count;
+
+        if (c != magic[matched]) {
+            matched = (c == magic[0]) ? 1 : 0;
+            continue;
+        }
+        if (++matched < sizeof(magic))
+            continue;
+        matched = 0;
+
+        if (fread(header, 1, sizeof(header), file) != sizeof(header))
+            break;
+        if (header[0] != 1 || header[1] != 7) {
+            fprintf(stderr, "Unsupported trace format version %d\n", header[0]);
+            continue;
+        }
+
+        count = header[2] | (header[3] << 8);
+        for (uint16_t i = 0; i < count; i++) {
+            uint8_t record[7];
+            if (fread(record, 1, sizeof(record), file) != sizeof(record)) {
+                fprintf(stderr, "Trace dump is truncated\n");
+                return dumps;
+            }
+            add_event(record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24),
+                      record[4], record[5] | (record[6] << 8));
+        }
+        dumps++;
+    }
+
+    return dumps;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *file = stdin;
+    int i = 1;
+
+    if (i < argc && strcmp(argv[i], "-v") == 0) {
+        verbose = 1;
+        i++;
+    }
+
+    if (i < argc) {
+        file = fopen(argv[i], "rb");
+        if (!file) {
+            perror(argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (read_dump(file) == 0) {
+        fprintf(stderr, "No trace dumps found\n");
+        exit(-1);
+    }
+
+    print_stages();
+
+    if (file != stdin)
+        fclose(file);
+
+    return 0;
+}
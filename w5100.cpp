@@ -32,22 +32,19 @@
 
 #include "w5100.h"
 
-#include <SPI.h>
+#if W5100_STATS
+#define W5100_STAT_ADD(field, n) (_stats.field += (n))
+#else
+#define W5100_STAT_ADD(field, n) do {} while (0)
+#endif
 
+#if W5100_TRACE
+#define W5100_TRACE_EVENT(event, length) trace(event, length)
+#else
+#define W5100_TRACE_EVENT(event, length) do {} while (0)
+#endif
 
-uint8_t Wiznet5100::wizchip_read(uint16_t address)
-{
-    uint8_t ret;
-
-    wizchip_cs_select();
-    SPI.transfer(0x0F);
-    SPI.transfer((address & 0xFF00) >>  8);
-    SPI.transfer((address & 0x00FF) >>  0);
-    ret = SPI.transfer(0);
-    wizchip_cs_deselect();
-
-    return ret;
-}
+volatile boolean Wiznet5100::_irq_fired = false;
 
 uint16_t Wiznet5100::wizchip_read_word(uint16_t address)
 {
@@ -55,276 +52,1365 @@ uint16_t Wiznet5100::wizchip_read_word(uint16_t address)
 }
 
 
-void Wiznet5100::wizchip_read_buf(uint16_t address, uint8_t* pBuf, uint16_t len)
-{
-    for(uint16_t i = 0; i < len; i++)
-    {
-        pBuf[i] = wizchip_read(address + i);
-    }
-}
-
-void Wiznet5100::wizchip_write(uint16_t address, uint8_t wb)
-{
-    wizchip_cs_select();
-    SPI.transfer(0xF0);
-    SPI.transfer((address & 0xFF00) >>  8);
-    SPI.transfer((address & 0x00FF) >>  0);
-    SPI.transfer(wb);    // Data write (write 1byte data)
-    wizchip_cs_deselect();
-}
-
 void Wiznet5100::wizchip_write_word(uint16_t address, uint16_t word)
 {
     wizchip_write(address,   (uint8_t)(word>>8));
     wizchip_write(address+1, (uint8_t) word);
 }
 
-void Wiznet5100::wizchip_write_buf(uint16_t address, const uint8_t* pBuf, uint16_t len)
-{
-    for(uint16_t i = 0; i < len; i++)
-    {
-        wizchip_write(address + i, pBuf[i]);
-    }
+boolean Wiznet5100::setSn_CR(uint8_t cr) {
+    return socketCommand(0, cr);
 }
 
-void Wiznet5100::setSn_CR(uint8_t cr) {
+boolean Wiznet5100::socketCommand(uint8_t sn, uint8_t cr) {
+    uint16_t address = WiznetRegisters::socketRegister(sn, Sn_CR::address);
+
     // Write the command to the Command Register
-    wizchip_write(Sn_CR, cr);
+    wizchip_write(address, cr);
 
     // Now wait for the command to complete
-    while( wizchip_read(Sn_CR) );
+    uint32_t start = micros();
+    while( wizchip_read(address) ) {
+        W5100_STAT_ADD(cmd_waits, 1);
+        if (WiznetBus::expired(start, WiznetBus::CommandTimeoutMicros)) {
+            W5100_STAT_ADD(cmd_timeouts, 1);
+            return false;
+        }
+    }
+    return true;
 }
 
 uint16_t Wiznet5100::getSn_TX_FSR()
 {
-    uint16_t val=0,val1=0;
-    do
-    {
-        val1 = wizchip_read_word(Sn_TX_FSR);
-        if (val1 != 0)
-        {
-            val = wizchip_read_word(Sn_TX_FSR);
-        }
-    } while (val != val1);
-    return val;
+    // Reporting no space is safe if it won't settle: the caller looks again later
+    return readCounter<Sn_TX_FSR>();
 }
 
 
 uint16_t Wiznet5100::getSn_RX_RSR()
 {
-    uint16_t val=0,val1=0;
-    do
+    // Reporting nothing received is safe if it won't settle: the caller looks again later
+    return readCounter<Sn_RX_RSR>();
+}
+
+uint16_t Wiznet5100::readCounter(uint16_t address)
+{
+    uint16_t val,val1;
+
+    // The chip may be changing it, so read it until it is the same twice
+    val = wizchip_read_word(address);
+    if (val == 0)
+        return 0;
+    for (uint8_t i = 0; i < RegisterReadTries; i++)
     {
-        val1 = wizchip_read_word(Sn_RX_RSR);
-        if (val1 != 0)
-        {
-            val = wizchip_read_word(Sn_RX_RSR);
-        }
-    } while (val != val1);
-    return val;
+        val1 = wizchip_read_word(address);
+        if (val1 == val)
+            return val;
+        val = val1;
+    }
+
+    return 0;
 }
 
-void Wiznet5100::wizchip_send_data(const uint8_t *wizdata, uint16_t len)
+void Wiznet5100::wizchip_write_tx(uint16_t ptr, const uint8_t *wizdata, uint16_t len)
+{
+    writeRing(TxBufferAddress, TxBufferLength, ptr, wizdata, len);
+}
+
+void Wiznet5100::writeRing(uint16_t base, uint16_t length, uint16_t ptr, const uint8_t *data, uint16_t len)
 {
-    uint16_t ptr;
     uint16_t size;
     uint16_t dst_mask;
     uint16_t dst_ptr;
 
-    ptr = getSn_TX_WR();
+    dst_mask = ptr & (length - 1);
+    dst_ptr = base + dst_mask;
 
-    dst_mask = ptr & TxBufferMask;
-    dst_ptr = TxBufferAddress + dst_mask;
-
-    if (dst_mask + len > TxBufferLength)
+    if (dst_mask + len > length)
     {
-        size = TxBufferLength - dst_mask;
-        wizchip_write_buf(dst_ptr, wizdata, size);
-        wizdata += size;
+        size = length - dst_mask;
+        wizchip_write_buf(dst_ptr, data, size);
+        data += size;
         size = len - size;
-        dst_ptr = TxBufferAddress;
-        wizchip_write_buf(dst_ptr, wizdata, size);
+        dst_ptr = base;
+        wizchip_write_buf(dst_ptr, data, size);
     }
     else
     {
-        wizchip_write_buf(dst_ptr, wizdata, len);
+        wizchip_write_buf(dst_ptr, data, len);
     }
+}
 
-    ptr += len;
-
-    setSn_TX_WR(ptr);
+void Wiznet5100::wizchip_read_rx(uint16_t ptr, uint8_t *wizdata, uint16_t len)
+{
+    readRing(RxBufferAddress, RxBufferLength, ptr, wizdata, len);
 }
 
-void Wiznet5100::wizchip_recv_data(uint8_t *wizdata, uint16_t len)
+void Wiznet5100::readRing(uint16_t base, uint16_t length, uint16_t ptr, uint8_t *data, uint16_t len)
 {
-    uint16_t ptr;
     uint16_t size;
     uint16_t src_mask;
     uint16_t src_ptr;
 
-    ptr = getSn_RX_RD();
-
-    src_mask = ptr & RxBufferMask;
-    src_ptr = RxBufferAddress + src_mask;
+    src_mask = ptr & (length - 1);
+    src_ptr = base + src_mask;
 
-
-    if( (src_mask + len) > RxBufferLength )
+    if( (src_mask + len) > length )
     {
-        size = RxBufferLength - src_mask;
-        wizchip_read_buf(src_ptr, wizdata, size);
-        wizdata += size;
+        size = length - src_mask;
+        wizchip_read_buf(src_ptr, data, size);
+        data += size;
         size = len - size;
-        src_ptr = RxBufferAddress;
-        wizchip_read_buf(src_ptr, wizdata, size);
+        src_ptr = base;
+        wizchip_read_buf(src_ptr, data, size);
     }
     else
     {
-        wizchip_read_buf(src_ptr, wizdata, len);
+        wizchip_read_buf(src_ptr, data, len);
     }
+}
 
-    ptr += len;
+boolean Wiznet5100::wizchip_sw_reset()
+{
+    setMR(WiznetRegisters::MR_RST);
 
-    setSn_RX_RD(ptr);
+    // The reset bit clears itself when the reset is complete
+    uint32_t start = micros();
+    while (getMR() & WiznetRegisters::MR_RST) {
+        if (WiznetBus::expired(start, WiznetBus::CommandTimeoutMicros))
+            return false;
+    }
+
+    setSHAR(_mac_address);
+    return true;
 }
 
-void Wiznet5100::wizchip_recv_ignore(uint16_t len)
+void Wiznet5100::setIPAddress(const uint8_t *address)
 {
-    uint16_t ptr;
-
-    ptr = getSn_RX_RD();
-    ptr += len;
-    setSn_RX_RD(ptr);
+    memcpy(_ip_address, address, 4);
+    setRegBuf<SIPR>(_ip_address);
 }
 
-void Wiznet5100::wizchip_sw_reset()
+void Wiznet5100::setGateway(const uint8_t *address)
 {
-    setMR(MR_RST);
-    getMR(); // for delay
+    memcpy(_gateway, address, 4);
+    setRegBuf<GAR>(_gateway);
+}
 
-    setSHAR(_mac_address);
+void Wiznet5100::setSubnetMask(const uint8_t *mask)
+{
+    memcpy(_subnet_mask, mask, 4);
+    setRegBuf<SUBR>(_subnet_mask);
 }
 
 
 Wiznet5100::Wiznet5100(int8_t cs)
 {
-    _cs = cs;
+    // Only made here, so that drivers given another bus don't carry it
+    _own_bus = new WiznetSpiBus(cs);
+    _bus = _own_bus;
+    init();
+}
+
+Wiznet5100::Wiznet5100(WiznetBus &bus)
+{
+    _own_bus = NULL;
+    _bus = &bus;
+    init();
+}
+
+Wiznet5100::~Wiznet5100()
+{
+    delete _own_bus;
+}
+
+void Wiznet5100::init()
+{
+#if W5100_POOL_FRAMES
+    // Chain all of the frame buffers into the free list
+    for (uint8_t i = 0; i < W5100_POOL_FRAMES; i++) {
+        _pool_next[i] = i + 1;
+    }
+    _pool_next[W5100_POOL_FRAMES - 1] = NoFrame;
+    _pool_free = 0;
+    _pool_used = 0;
+#endif
+    _filtered_frames = 0;
+    _filtered_bytes = 0;
+#if W5100_STATS
+    resetStats();
+#endif
+#if W5100_TRACE
+    _trace_next = 0;
+    _trace_count = 0;
+#endif
+    _tx_sending = false;
+    _tx_queued = 0;
+    _tx_reserved = false;
+    _tx_wr = 0;
+    _tx_free = 0;
+    _async_op = AsyncIdle;
+    _async_done = false;
+    _int_pin = -1;
+    _sn_ir = 0;
+    _calibrate_clock = false;
+    _timeout = W5100_TIMEOUT;
+    memset(_ip_address, 0, sizeof(_ip_address));
+    memset(_gateway, 0, sizeof(_gateway));
+    memset(_subnet_mask, 0, sizeof(_subnet_mask));
+    _ethertype_count = 0;
+    _accept_broadcast = true;
+    _hw_filter = false;
+    acceptAllMulticast();
 }
 
 boolean Wiznet5100::begin(const uint8_t *mac_address)
 {
     memcpy(_mac_address, mac_address, 6);
 
-    pinMode(_cs, OUTPUT);
-    wizchip_cs_deselect();
+    _bus->begin();
+
+    if (_calibrate_clock && !calibrateClock()) {
+        // The chip didn't respond properly at any clock
+        return false;
+    }
+
+    return reinit() == StatusOk;
+}
 
-    SPI.begin();
-    SPI.setClockDivider(SPI_CLOCK_DIV4); // 4 MHz?
-    SPI.setBitOrder(MSBFIRST);
-    SPI.setDataMode(SPI_MODE0);
+Wiznet5100::Status Wiznet5100::reinit()
+{
+    // The chip is reset whether or not the transfer stopped in time
+    Status aborted = abortTransfer(micros(), _timeout);
 
-    wizchip_sw_reset();
+    if (!wizchip_sw_reset())
+        return StatusNoResponse;
 
     // Set the size of the Rx and Tx buffers
-    wizchip_write(RMSR, RxBufferSize);
-    wizchip_write(TMSR, TxBufferSize);
+    setReg<RMSR>(RxBufferSize);
+    setReg<TMSR>(TxBufferSize);
 
-    // Set our local MAC address
+    // Set our local MAC address, and the IP settings for the other sockets
     setSHAR(_mac_address);
+    setRegBuf<SIPR>(_ip_address);
+    setRegBuf<GAR>(_gateway);
+    setRegBuf<SUBR>(_subnet_mask);
+
+    _tx_sending = false;
+    _tx_queued = 0;
+    _tx_reserved = false;
+    _sn_ir = 0;
+    if (_int_pin >= 0) {
+        // Re-enable the socket interrupt after the reset
+        setReg<IMR>(IMR_S0_INT);
+    }
 
     // Open Socket 0 in MACRaw mode
-    setSn_MR(Sn_MR_MACRAW);
-    setSn_CR(Sn_CR_OPEN);
-    if (getSn_SR() != SOCK_MACRAW) {
+    // The MAC filter in the chip drops multicast, so only use it when none is wanted
+    uint8_t mode = WiznetRegisters::Sn_MR_MACRAW;
+    if (_hw_filter) {
+        mode |= WiznetRegisters::Sn_MR_MF;
+        for (uint8_t i = 0; i < sizeof(_multicast_hash); i++) {
+            if (_multicast_hash[i])
+                mode &= ~WiznetRegisters::Sn_MR_MF;
+        }
+    }
+    setSn_MR(mode);
+    if (!setSn_CR(WiznetRegisters::Sn_CR_OPEN))
+        return StatusNoResponse;
+    if (getSn_SR() != WiznetRegisters::SOCK_MACRAW) {
         // Failed to put socket 0 into MACRaw mode
-        return false;
+        return StatusClosed;
     }
 
-    // Success
-    return true;
+    // From now on, only the driver moves the Tx write pointer
+    _tx_wr = getSn_TX_WR();
+    _tx_free = getSn_TX_FSR();
+
+    return aborted;
 }
 
 void Wiznet5100::end()
 {
-    setSn_CR(Sn_CR_CLOSE);
+    end(_timeout);
+}
+
+Wiznet5100::Status Wiznet5100::end(uint32_t timeout)
+{
+    uint32_t start = micros();
+    Status aborted;
+
+    aborted = abortTransfer(start, timeout);
+
+    if (!setSn_CR(WiznetRegisters::Sn_CR_CLOSE))
+        return StatusNoResponse;
 
     // clear all interrupt of the socket
     setSn_IR(0xFF);
 
     // Wait for socket to change to closed
-    while(getSn_SR() != SOCK_CLOSED);
+    while(getSn_SR() != WiznetRegisters::SOCK_CLOSED) {
+        if (WiznetBus::expired(start, timeout)) {
+            W5100_STAT_ADD(timeouts, 1);
+            return StatusTimeout;
+        }
+    }
+
+    return aborted;
 }
 
-uint16_t Wiznet5100::readFrame(uint8_t *buffer, uint16_t bufsize)
+void Wiznet5100::setClockCalibration(boolean enable)
+{
+    _calibrate_clock = enable;
+}
+
+boolean Wiznet5100::testBus()
+{
+    uint8_t pattern[32];
+    uint8_t check[32];
+    boolean ok = true;
+
+    for (uint8_t round = 0; round < CalibrationRounds && ok; round++) {
+        // Alternating and walking bits, different in each round
+        for (uint8_t i = 0; i < sizeof(pattern); i++) {
+            pattern[i] = (uint8_t)(i * 37 + round * 11) ^ ((i & 1) ? 0xAA : 0x55);
+        }
+
+        // GAR and SUBR aren't used in MACRAW mode, so they make 8 bytes of scratch
+        setRegBuf<GAR>(pattern);
+        setRegBuf<SUBR>(pattern + 4);
+        getRegBuf<GAR>(check);
+        getRegBuf<SUBR>(check + 4);
+        if (memcmp(pattern, check, 8) != 0)
+            ok = false;
+
+        wizchip_write_buf(TxBufferAddress, pattern, sizeof(pattern));
+        wizchip_read_buf(TxBufferAddress, check, sizeof(check));
+        if (memcmp(pattern, check, sizeof(pattern)) != 0)
+            ok = false;
+    }
+
+    memset(pattern, 0, 8);
+    setRegBuf<GAR>(pattern);
+    setRegBuf<SUBR>(pattern + 4);
+
+    return ok;
+}
+
+boolean Wiznet5100::calibrateClock()
+{
+    uint32_t start = _bus->clock();
+    uint32_t clock;
+
+    if (start == 0)
+        return true;
+
+    for (clock = start; clock >= MinCalibrationClock; clock /= 2) {
+        _bus->setClock(clock);
+        if (!testBus())
+            continue;
+
+        if (clock != start && clock / 2 >= MinCalibrationClock) {
+            // It failed faster than this, so use the next clock down for a margin
+            _bus->setClock(clock / 2);
+            if (testBus())
+                return true;
+            _bus->setClock(clock);
+        }
+        return true;
+    }
+
+    _bus->setClock(start);
+    return false;
+}
+
+#if W5100_STATS
+void Wiznet5100::getStats(Stats &stats) const
+{
+    stats = _stats;
+    stats.rx_filtered = _filtered_frames;
+    stats.rx_filtered_bytes = _filtered_bytes;
+    stats.bus_transactions = _bus->transactions();
+}
+
+void Wiznet5100::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _filtered_frames = 0;
+    _filtered_bytes = 0;
+    _bus->resetTransactions();
+#if W5100_POOL_FRAMES
+    _stats.pool_high_water = _pool_used;
+#endif
+}
+#endif
+
+#if W5100_TRACE
+void Wiznet5100::trace(uint8_t event, uint16_t length)
+{
+    TraceRecord &record = _trace[_trace_next];
+
+    record.time = micros();
+    record.event = event;
+    record.length = length;
+
+    if (++_trace_next >= W5100_TRACE_SIZE)
+        _trace_next = 0;
+    if (_trace_count < W5100_TRACE_SIZE)
+        _trace_count++;
+}
+
+void Wiznet5100::dumpTrace(Print &out)
+{
+    uint8_t header[8] = { 'W', '5', 'T', 'R', 1, 7, _trace_count, 0 };
+    uint8_t i = (_trace_next + W5100_TRACE_SIZE - _trace_count) % W5100_TRACE_SIZE;
+
+    out.write(header, sizeof(header));
+
+    for (; _trace_count > 0; _trace_count--)
+    {
+        const TraceRecord &record = _trace[i];
+        uint8_t buf[7] = {
+            (uint8_t)(record.time >> 0), (uint8_t)(record.time >> 8),
+            (uint8_t)(record.time >> 16), (uint8_t)(record.time >> 24),
+            record.event,
+            (uint8_t)(record.length >> 0), (uint8_t)(record.length >> 8)
+        };
+
+        out.write(buf, sizeof(buf));
+        if (++i >= W5100_TRACE_SIZE)
+            i = 0;
+    }
+}
+#endif
+
+boolean Wiznet5100::enableInterrupt(uint8_t pin)
+{
+    int irq = digitalPinToInterrupt(pin);
+    if (irq == NOT_AN_INTERRUPT) {
+        return false;
+    }
+
+    _int_pin = pin;
+    _irq_fired = true;   // Check the chip once, in case INT is already low
+
+    pinMode(pin, INPUT);
+    setReg<IMR>(IMR_S0_INT);
+    attachInterrupt(irq, isr, FALLING);
+
+    return true;
+}
+
+void Wiznet5100::disableInterrupt()
 {
-    uint16_t len = getSn_RX_RSR();
+    if (_int_pin < 0)
+        return;
 
-    if (len > 0)
+    detachInterrupt(digitalPinToInterrupt(_int_pin));
+    setReg<IMR>(0);
+    _int_pin = -1;
+}
+
+void Wiznet5100::isr()
+{
+    // SPI may be in use by the main loop, so just note that the chip wants attention
+    _irq_fired = true;
+}
+
+uint8_t Wiznet5100::getSocketInterrupts()
+{
+    if (_int_pin < 0 || _irq_fired)
     {
-        uint8_t head[2];
-        uint16_t data_len=0;
+        uint8_t ir;
+        uint8_t tries = InterruptClearTries;
 
-        wizchip_recv_data(head, 2);
-        setSn_CR(Sn_CR_RECV);
+        _irq_fired = false;
+        do {
+            ir = getSn_IR();
+            if (ir) {
+                // Latch and clear the interrupts on the chip
+                setSn_IR(ir);
+                _sn_ir |= ir;
+            }
+            // In interrupt mode, repeat until they stay clear, so that INT
+            // goes high and the next interrupt makes a new falling edge.
+            // If they never do, give up and look again on the next call.
+        } while (ir && _int_pin >= 0 && --tries);
+        if (ir && _int_pin >= 0)
+            _irq_fired = true;
+    }
 
-        data_len = head[0];
-        data_len = (data_len<<8) + head[1];
-        data_len -= 2;
+    return _sn_ir;
+}
 
-        if (data_len > bufsize)
-        {
-            // Packet is bigger than buffer - drop the packet
-            wizchip_recv_ignore(data_len);
-            setSn_CR(Sn_CR_RECV);
-            return 0;
+boolean Wiznet5100::addEtherType(uint16_t ethertype)
+{
+    if (_ethertype_count >= W5100_ETHERTYPE_FILTER_SIZE)
+        return false;
+
+    _ethertypes[_ethertype_count++] = ethertype;
+    return true;
+}
+
+void Wiznet5100::clearEtherTypes()
+{
+    _ethertype_count = 0;
+}
+
+void Wiznet5100::setBroadcast(boolean accept)
+{
+    _accept_broadcast = accept;
+}
+
+void Wiznet5100::addMulticastAddress(const uint8_t *address)
+{
+    uint8_t bin = multicastHash(address);
+    _multicast_hash[bin >> 3] |= (1 << (bin & 7));
+}
+
+void Wiznet5100::clearMulticastAddresses()
+{
+    memset(_multicast_hash, 0x00, sizeof(_multicast_hash));
+}
+
+void Wiznet5100::acceptAllMulticast()
+{
+    memset(_multicast_hash, 0xFF, sizeof(_multicast_hash));
+}
+
+void Wiznet5100::setHardwareFilter(boolean enable)
+{
+    _hw_filter = enable;
+}
+
+uint8_t Wiznet5100::multicastHash(const uint8_t *address)
+{
+    // Ethernet CRC-32, with the bits of each byte taken least significant first
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < 6; i++) {
+        uint8_t b = address[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            if (((crc >> 31) ^ b) & 0x01) {
+                crc = (crc << 1) ^ 0x04C11DB7;
+            } else {
+                crc <<= 1;
+            }
+            b >>= 1;
         }
+    }
+    return crc >> 26;
+}
 
-        wizchip_recv_data(buffer, data_len);
-        setSn_CR(Sn_CR_RECV);
+boolean Wiznet5100::acceptFrame(const uint8_t *header)
+{
+    if (header[0] & 0x01) {
+        // Broadcast is the all-ones multicast address
+        uint8_t ones = 0xFF;
+        for (uint8_t i = 0; i < 6; i++) {
+            ones &= header[i];
+        }
 
-        // W5100 doesn't have any built-in MAC address filtering
-        if ((buffer[0] & 0x01) || memcmp(&buffer[0], _mac_address, 6) == 0)
-        {
-            // Addressed to an Ethernet multicast address or our unicast address
-            return data_len;
+        if (ones == 0xFF) {
+            if (!_accept_broadcast)
+                return false;
         } else {
-            return 0;
+            uint8_t bin = multicastHash(header);
+            if (!(_multicast_hash[bin >> 3] & (1 << (bin & 7))))
+                return false;
         }
+    } else if (memcmp(&header[0], _mac_address, 6) != 0) {
+        // Not for us
+        return false;
     }
 
-    return 0;
+    if (_ethertype_count == 0)
+        return true;
+
+    uint16_t ethertype = (header[12] << 8) | header[13];
+    for (uint8_t i = 0; i < _ethertype_count; i++) {
+        if (_ethertypes[i] == ethertype)
+            return true;
+    }
+
+    return false;
 }
 
-uint16_t Wiznet5100::sendFrame(const uint8_t *buf, uint16_t len)
+uint16_t Wiznet5100::readFrame(uint8_t *buffer, uint16_t bufsize)
 {
-    // Wait for space in the transmit buffer
-    while(1)
+    uint16_t len;
+
+    if (readFrames(buffer, bufsize, &len, 1) > 0) {
+        return len;
+    } else {
+        return 0;
+    }
+}
+
+#if W5100_POOL_FRAMES
+boolean Wiznet5100::FrameQueue::push(FrameHandle frame)
+{
+    if (_count >= W5100_POOL_FRAMES)
+        return false;
+
+    _frames[(_head + _count) % W5100_POOL_FRAMES] = frame;
+    _count++;
+    return true;
+}
+
+Wiznet5100::FrameHandle Wiznet5100::FrameQueue::pop()
+{
+    if (_count == 0)
+        return NoFrame;
+
+    FrameHandle frame = _frames[_head];
+    _head = (_head + 1) % W5100_POOL_FRAMES;
+    _count--;
+    return frame;
+}
+
+Wiznet5100::FrameHandle Wiznet5100::allocFrame()
+{
+    FrameHandle frame = _pool_free;
+    if (frame == NoFrame) {
+        W5100_STAT_ADD(pool_exhausted, 1);
+        return NoFrame;
+    }
+
+    _pool_free = _pool_next[frame];
+    _pool_length[frame] = 0;
+    _pool_used++;
+#if W5100_STATS
+    if (_pool_used > _stats.pool_high_water)
+        _stats.pool_high_water = _pool_used;
+#endif
+    return frame;
+}
+
+void Wiznet5100::freeFrame(FrameHandle frame)
+{
+    _pool_next[frame] = _pool_free;
+    _pool_free = frame;
+    _pool_used--;
+}
+
+Wiznet5100::FrameHandle Wiznet5100::readFrame()
+{
+    FrameHandle frame = _pool_free;
+    uint16_t len;
+
+    if (frame == NoFrame) {
+        W5100_STAT_ADD(pool_exhausted, 1);
+        return NoFrame;
+    }
+
+    // Read into the next free buffer, and only take it if a frame arrived
+    if (readFrames(_pool[frame], W5100_POOL_FRAME_SIZE, &len, 1) == 0)
+        return NoFrame;
+
+    frame = allocFrame();
+    _pool_length[frame] = len;
+    return frame;
+}
+
+uint16_t Wiznet5100::sendFrame(FrameHandle frame)
+{
+    uint16_t len = sendFrame(_pool[frame], _pool_length[frame]);
+    freeFrame(frame);
+    return len;
+}
+
+boolean Wiznet5100::sendFrameAsync(FrameHandle frame)
+{
+    if (!sendFrameAsync(_pool[frame], _pool_length[frame]))
+        return false;
+
+    freeFrame(frame);
+    return true;
+}
+#endif
+
+uint16_t Wiznet5100::rxAvailable()
+{
+    uint16_t len;
+
+    // The frame being read in the background is still in the receive buffer,
+    // and while any transfer is moving, the bus mustn't be used for anything else
+    if (_async_op != AsyncIdle)
+        return 0;
+
+    // In interrupt mode, don't touch the bus until the chip says it has received something
+    if (_int_pin >= 0 && !(getSocketInterrupts() & WiznetRegisters::Sn_IR_RECV))
+        return 0;
+
+    len = getSn_RX_RSR();
+    if (len == 0) {
+        _sn_ir &= ~WiznetRegisters::Sn_IR_RECV;
+    } else {
+        W5100_TRACE_EVENT(TraceRxDetected, len);
+    }
+
+    return len;
+}
+
+uint16_t Wiznet5100::rxFrameLength(uint16_t ptr, uint16_t len)
+{
+    uint8_t head[2];
+    uint16_t frame_len;
+
+    if (len <= 2)
+        return 0;
+
+    wizchip_read_rx(ptr, head, 2);
+    frame_len = head[0];
+    frame_len = (frame_len<<8) + head[1];
+    if (frame_len <= 2 || frame_len > len) {
+        // Not a complete frame
+        return 0;
+    }
+
+    return frame_len;
+}
+
+void Wiznet5100::rxRelease(uint16_t ptr, uint16_t len)
+{
+    setSn_RX_RD(ptr);
+    setSn_CR(WiznetRegisters::Sn_CR_RECV);
+    W5100_TRACE_EVENT(TraceRxCommit, len);
+
+    if (len == 0) {
+        // Everything has been read - wait for the next RECV interrupt
+        _sn_ir &= ~WiznetRegisters::Sn_IR_RECV;
+    }
+}
+
+uint8_t Wiznet5100::readFrames(uint8_t *buffer, uint16_t bufsize, uint16_t *lengths, uint8_t maxframes)
+{
+    uint16_t len;
+    uint16_t ptr, start;
+    uint16_t used = 0;
+    uint8_t count = 0;
+
+    len = rxAvailable();
+    if (len == 0)
+        return 0;
+
+    // Work from our own copy of the read pointer and
+    // only write it back once all of the frames have been read
+    ptr = start = getSn_RX_RD();
+
+    while (count < maxframes)
     {
-        uint16_t freesize = getSn_TX_FSR();
-        if(getSn_SR() == SOCK_CLOSED) {
-            return -1;
+        uint16_t frame_len, data_len;
+
+        frame_len = rxFrameLength(ptr, len);
+        if (frame_len == 0)
+            break;
+        data_len = frame_len - 2;
+
+        if (data_len < EthernetHeaderLength)
+        {
+            // Packet is too short - drop the packet
+            W5100_STAT_ADD(rx_runts, 1);
+        }
+        else if (data_len > bufsize)
+        {
+            // Packet is bigger than buffer - drop the packet
+            W5100_STAT_ADD(rx_oversize, 1);
+        }
+        else if (data_len > bufsize - used)
+        {
+            // No room left in the buffer - leave it for the next call
+            break;
         }
-        if (len <= freesize) break;
-    };
+        else
+        {
+            uint8_t *frame = buffer + used;
+
+            // Only read the Ethernet header, so that unwanted frames
+            // can be skipped without copying their payload over SPI
+            wizchip_read_rx(ptr + 2, frame, EthernetHeaderLength);
+            W5100_TRACE_EVENT(TraceRxHeader, data_len);
+            if (acceptFrame(frame))
+            {
+                wizchip_read_rx(ptr + 2 + EthernetHeaderLength,
+                                frame + EthernetHeaderLength,
+                                data_len - EthernetHeaderLength);
+                W5100_TRACE_EVENT(TraceRxPayload, data_len);
+                lengths[count++] = data_len;
+                used += data_len;
+                W5100_STAT_ADD(rx_frames, 1);
+                W5100_STAT_ADD(rx_bytes, data_len);
+            }
+            else
+            {
+                _filtered_frames++;
+                _filtered_bytes += data_len - EthernetHeaderLength;
+            }
+        }
+
+        ptr += frame_len;
+        len -= frame_len;
+    }
+
+    if (ptr != start) {
+        rxRelease(ptr, len);
+    }
 
-    wizchip_send_data(buf, len);
-    setSn_CR(Sn_CR_SEND);
+    return count;
+}
 
-    while(1)
+Wiznet5100::FrameReader Wiznet5100::beginFrame()
+{
+    FrameReader frame;
+    uint16_t len;
+    uint16_t ptr, start;
+
+    len = rxAvailable();
+    if (len == 0)
+        return frame;
+
+    ptr = start = getSn_RX_RD();
+
+    while (1)
     {
-        uint8_t tmp = getSn_IR();
-        if (tmp & Sn_IR_SENDOK)
-        {
-            setSn_IR(Sn_IR_SENDOK);
-            // Packet sent ok
+        uint16_t frame_len, data_len;
+
+        frame_len = rxFrameLength(ptr, len);
+        if (frame_len == 0)
             break;
+        data_len = frame_len - 2;
+
+        if (data_len >= EthernetHeaderLength)
+        {
+            wizchip_read_rx(ptr + 2, frame._header, EthernetHeaderLength);
+            W5100_TRACE_EVENT(TraceRxHeader, data_len);
+            if (acceptFrame(frame._header))
+            {
+                // The read pointer is written back by FrameReader::end()
+                frame._driver = this;
+                frame._start = ptr + 2;
+                frame._length = data_len;
+                frame._pos = 0;
+                frame._after = len - frame_len;
+                W5100_STAT_ADD(rx_frames, 1);
+                W5100_STAT_ADD(rx_bytes, data_len);
+                return frame;
+            }
+
+            _filtered_frames++;
+            _filtered_bytes += data_len - EthernetHeaderLength;
         }
-        else if (tmp & Sn_IR_TIMEOUT)
+        else
         {
-            setSn_IR(Sn_IR_TIMEOUT);
-            // There was a timeout
-            return -1;
+            W5100_STAT_ADD(rx_runts, 1);
+        }
+
+        ptr += frame_len;
+        len -= frame_len;
+    }
+
+    // Release any frames that were skipped
+    if (ptr != start) {
+        rxRelease(ptr, len);
+    }
+
+    return frame;
+}
+
+void Wiznet5100::FrameReader::readAt(uint16_t offset, uint8_t *dst, uint16_t n)
+{
+    uint16_t count = 0;
+
+    // The header has already been read from the chip
+    if (offset < EthernetHeaderLength) {
+        count = EthernetHeaderLength - offset;
+        if (count > n)
+            count = n;
+        memcpy(dst, &_header[offset], count);
+    }
+
+    if (count < n) {
+        _driver->wizchip_read_rx(_start + offset + count, dst + count, n - count);
+    }
+}
+
+uint16_t Wiznet5100::FrameReader::read(uint8_t *dst, uint16_t n)
+{
+    if (n > remaining())
+        n = remaining();
+
+    readAt(_pos, dst, n);
+    _pos += n;
+    return n;
+}
+
+uint16_t Wiznet5100::FrameReader::skip(uint16_t n)
+{
+    if (n > remaining())
+        n = remaining();
+
+    _pos += n;
+    return n;
+}
+
+void Wiznet5100::FrameReader::end()
+{
+    if (_driver == NULL)
+        return;
+
+    _driver->rxRelease(_start + _length, _after);
+    _driver = NULL;
+}
+
+boolean Wiznet5100::forwardFrame(FrameReader &frame, RewriteCallback rewrite, void *context)
+{
+    return copyFrame(frame, false, rewrite, context);
+}
+
+boolean Wiznet5100::reflectFrame(FrameReader &frame, RewriteCallback rewrite, void *context)
+{
+    return copyFrame(frame, true, rewrite, context);
+}
+
+boolean Wiznet5100::copyFrame(FrameReader &frame, boolean reflect, RewriteCallback rewrite, void *context)
+{
+    uint8_t chunk[ForwardChunkSize];
+    uint16_t len = frame.length();
+    uint16_t ptr;
+    uint32_t start = micros();
+
+    // There is nothing to copy from a reader with no frame
+    if (!frame)
+        return false;
+
+    W5100_TRACE_EVENT(TraceTxStart, len);
+
+    // Wait for space in the transmit buffer
+    while (!txReserve(len, ptr))
+    {
+        W5100_STAT_ADD(tx_full_spins, 1);
+        if (len > TxBufferLength || getSn_SR() == WiznetRegisters::SOCK_CLOSED) {
+            frame.end();
+            return false;
+        }
+        if (WiznetBus::expired(start, _timeout)) {
+            W5100_STAT_ADD(timeouts, 1);
+            frame.end();
+            return false;
         }
+        poll();
+    }
+
+    for (uint16_t offset = 0; offset < len; offset += sizeof(chunk))
+    {
+        uint16_t size = len - offset;
+        if (size > sizeof(chunk))
+            size = sizeof(chunk);
+
+        frame.readAt(offset, chunk, size);
+
+        if (reflect && offset == 0) {
+            memcpy(&chunk[0], &chunk[6], 6);        // Set Destination to Source
+            memcpy(&chunk[6], _mac_address, 6);     // Set Source to our MAC address
+        }
+
+        if (rewrite) {
+            rewrite(chunk, offset, size, context);
+        }
+
+        wizchip_write_tx(ptr + offset, chunk, size);
+    }
+
+    frame.end();
+    txCommit(len);
+
+    return true;
+}
+
+Wiznet5100::FrameWriter Wiznet5100::beginSendFrame(uint16_t maxlen)
+{
+    FrameWriter frame;
+    uint16_t ptr;
+
+    if (!txReserve(maxlen, ptr))
+        return frame;
+
+    // The write pointer is only moved on by FrameWriter::send(),
+    // so hold the space until then
+    _tx_reserved = true;
+    frame._driver = this;
+    frame._start = ptr;
+    frame._length = maxlen;
+    frame._pos = 0;
+    return frame;
+}
+
+uint16_t Wiznet5100::FrameWriter::write(const uint8_t *src, uint16_t n)
+{
+    if (n > remaining())
+        n = remaining();
+
+    _driver->wizchip_write_tx(_start + _pos, src, n);
+    _pos += n;
+    return n;
+}
+
+void Wiznet5100::FrameWriter::writeAt(uint16_t offset, const uint8_t *src, uint16_t n)
+{
+    _driver->wizchip_write_tx(_start + offset, src, n);
+}
+
+void Wiznet5100::FrameWriter::send()
+{
+    if (_driver == NULL)
+        return;
+
+    _driver->_tx_reserved = false;
+    if (_pos > 0)
+        _driver->txCommit(_pos);
+    _driver = NULL;
+}
+
+void Wiznet5100::FrameWriter::cancel()
+{
+    if (_driver == NULL)
+        return;
+
+    _driver->_tx_reserved = false;
+    _driver = NULL;
+}
+
+boolean Wiznet5100::txReserve(uint16_t len, uint16_t &ptr)
+{
+    // Only one frame can wait behind the one being sent, and the
+    // ones being written by a FrameWriter or copied in the background go first
+    if (_tx_queued || _tx_reserved || _async_op == AsyncSending)
+        return false;
+
+    // Space only ever becomes free, so the chip only needs to be
+    // asked again when the space we know about is not enough
+    if (len > _tx_free) {
+        // The free size includes the frame currently being sent
+        _tx_free = getSn_TX_FSR();
+        if (len > _tx_free)
+            return false;
+    }
+
+    ptr = _tx_wr;
+    W5100_TRACE_EVENT(TraceTxReserved, len);
+    return true;
+}
+
+void Wiznet5100::txCommit(uint16_t len)
+{
+    _tx_wr += len;
+    _tx_free -= len;
+    W5100_TRACE_EVENT(TraceTxQueued, len);
+
+    if (_tx_sending) {
+        // Send it once the current frame has gone
+        _tx_queued = len;
+    } else {
+        setSn_TX_WR(_tx_wr);
+        setSn_CR(WiznetRegisters::Sn_CR_SEND);
+        W5100_TRACE_EVENT(TraceTxSend, len);
+        _tx_len = len;
+        _tx_sending = true;
+        _tx_started = micros();
+    }
+}
+
+boolean Wiznet5100::sendFrameAsync(const uint8_t *buf, uint16_t len)
+{
+    Segment segment = { buf, len };
+    return sendFrameVAsync(&segment, 1);
+}
+
+boolean Wiznet5100::sendFrameVAsync(const Segment *segments, uint8_t count)
+{
+    uint16_t len = 0;
+    uint16_t ptr;
+
+    for (uint8_t i = 0; i < count; i++) {
+        len += segments[i].len;
+    }
+
+    if (!txReserve(len, ptr))
+        return false;
+
+    // Copy the frame while the previous one is being transmitted
+    for (uint8_t i = 0; i < count; i++) {
+        wizchip_write_tx(ptr, segments[i].data, segments[i].len);
+        ptr += segments[i].len;
+    }
+    txCommit(len);
+
+    return true;
+}
+
+boolean Wiznet5100::submitReceive(uint8_t *buffer, uint16_t bufsize, TransferCallback done, void *context)
+{
+    if (_async_op != AsyncIdle)
+        return false;
+
+    FrameReader frame = beginFrame();
+    if (!frame)
+        return false;
+
+    if (frame.length() > bufsize) {
+        W5100_STAT_ADD(rx_oversize, 1);
+        frame.end();
+        return false;
+    }
+
+    // The header has already been read, so only the rest needs to move
+    memcpy(buffer, frame.header(), EthernetHeaderLength);
+    _async_op = AsyncReceiving;
+    _async_frame = frame;
+    _async_len = frame.length();
+    _async_callback = done;
+    _async_context = context;
+    startTransfer(false, RxBufferAddress, RxBufferLength, frame._start + EthernetHeaderLength,
+                  buffer + EthernetHeaderLength, frame.length() - EthernetHeaderLength);
+
+    return true;
+}
+
+boolean Wiznet5100::submitSend(const uint8_t *data, uint16_t len, TransferCallback done, void *context)
+{
+    uint16_t ptr;
+
+    if (_async_op != AsyncIdle || len == 0 || !txReserve(len, ptr))
+        return false;
+
+    _async_op = AsyncSending;
+    _async_len = len;
+    _async_callback = done;
+    _async_context = context;
+    startTransfer(true, TxBufferAddress, TxBufferLength, ptr, data, len);
+
+    return true;
+}
+
+void Wiznet5100::startTransfer(boolean write, uint16_t base, uint16_t length, uint16_t ptr, const uint8_t *data, uint16_t len)
+{
+    uint16_t offset = ptr & (length - 1);
+    uint16_t size = len;
+
+    if (offset + len > length)
+        size = length - offset;
+
+    // The second piece is started by transferPieceDone()
+    _async_write = write;
+    _async_base = base;
+    _async_rest = data + size;
+    _async_rest_len = len - size;
+    _async_done = false;
+
+    if (write) {
+        _bus->submitWrite(base + offset, data, size, transferPieceDone, this);
+    } else {
+        _bus->submitRead(base + offset, const_cast<uint8_t *>(data), size, transferPieceDone, this);
+    }
+}
+
+void Wiznet5100::transferPieceDone(void *context)
+{
+    // This may be called from an interrupt, so only the bus is touched
+    Wiznet5100 *self = (Wiznet5100 *)context;
+    uint16_t len = self->_async_rest_len;
+
+    if (len == 0) {
+        self->_async_done = true;
+        return;
+    }
+
+    self->_async_rest_len = 0;
+    if (self->_async_write) {
+        self->_bus->submitWrite(self->_async_base, self->_async_rest, len, transferPieceDone, self);
+    } else {
+        self->_bus->submitRead(self->_async_base, const_cast<uint8_t *>(self->_async_rest), len, transferPieceDone, self);
+    }
+}
+
+void Wiznet5100::completeTransfer()
+{
+    if (_async_op == AsyncSending) {
+        txCommit(_async_len);
+    } else {
+        _async_frame.end();
+    }
+
+    // The callback may start the next one
+    _async_op = AsyncIdle;
+    _async_done = false;
+    _async_callback(_async_len, _async_context);
+}
+
+Wiznet5100::Status Wiznet5100::abortTransfer(uint32_t start, uint32_t timeout)
+{
+    Status status = StatusOk;
+
+    if (_async_op == AsyncIdle)
+        return StatusOk;
+
+    // The bus has to finish with the RAM before it is given back
+    while (!_async_done) {
+        if (WiznetBus::expired(start, timeout)) {
+            // Stop it instead, so that it can't touch the RAM afterwards
+            _bus->cancel();
+            W5100_STAT_ADD(timeouts, 1);
+            status = StatusTimeout;
+            break;
+        }
+        _bus->service();
+    }
+
+    _async_op = AsyncIdle;
+    _async_done = false;
+    _async_frame = FrameReader();
+    _async_callback(0, _async_context);
+    return status;
+}
+
+Wiznet5100::TxStatus Wiznet5100::poll()
+{
+    TxStatus status;
+
+    // Don't touch the bus while a frame is moving in the background
+    if (_async_op != AsyncIdle) {
+        _bus->service();
+        if (!_async_done)
+            return TxBusy;
+        completeTransfer();
+    }
+
+    if (!_tx_sending)
+        return TxIdle;
+
+    uint8_t tmp = getSocketInterrupts();
+    if (tmp & WiznetRegisters::Sn_IR_SENDOK)
+    {
+        _sn_ir &= ~WiznetRegisters::Sn_IR_SENDOK;
+        // Packet sent ok
+        status = TxComplete;
+    }
+    else if (tmp & WiznetRegisters::Sn_IR_TIMEOUT)
+    {
+        _sn_ir &= ~WiznetRegisters::Sn_IR_TIMEOUT;
+        // There was a timeout
+        status = TxTimeout;
+    }
+    else if (micros() - _tx_started > TxTimeoutMicros)
+    {
+        // Never heard back from the chip
+        status = TxTimeout;
+    }
+    else
+    {
+        return TxBusy;
+    }
+
+    if (status == TxComplete) {
+        W5100_TRACE_EVENT(TraceTxSendOk, _tx_len);
+        W5100_STAT_ADD(tx_frames, 1);
+        W5100_STAT_ADD(tx_bytes, _tx_len);
+    } else {
+        W5100_TRACE_EVENT(TraceTxTimeout, _tx_len);
+        W5100_STAT_ADD(tx_timeouts, 1);
+    }
+
+    if (_tx_queued) {
+        // Start sending the frame that was copied in the meantime
+        setSn_TX_WR(_tx_wr);
+        setSn_CR(WiznetRegisters::Sn_CR_SEND);
+        W5100_TRACE_EVENT(TraceTxSend, _tx_queued);
+        _tx_len = _tx_queued;
+        _tx_queued = 0;
+        _tx_started = micros();
+    } else {
+        _tx_sending = false;
+    }
+
+    return status;
+}
+
+uint16_t Wiznet5100::sendFrame(const uint8_t *buf, uint16_t len)
+{
+    Segment segment = { buf, len };
+    return sendFrameV(&segment, 1);
+}
+
+Wiznet5100::Status Wiznet5100::sendFrame(const uint8_t *buf, uint16_t len, uint32_t timeout)
+{
+    Segment segment = { buf, len };
+    return sendFrameV(&segment, 1, timeout);
+}
+
+uint16_t Wiznet5100::sendFrameV(const Segment *segments, uint8_t count)
+{
+    uint16_t len = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        len += segments[i].len;
+    }
+
+    if (sendFrameV(segments, count, _timeout) != StatusOk) {
+        return -1;
     }
 
     return len;
 }
+
+Wiznet5100::Status Wiznet5100::sendFrameV(const Segment *segments, uint8_t count, uint32_t timeout)
+{
+    TxStatus status;
+    uint16_t len = 0;
+    uint32_t start = micros();
+
+    for (uint8_t i = 0; i < count; i++) {
+        len += segments[i].len;
+    }
+
+    if (len > TxBufferLength) {
+        // Would never fit, however long we waited
+        return StatusTooLong;
+    }
+
+    W5100_TRACE_EVENT(TraceTxStart, len);
+
+    // Wait for any asynchronous frames to be sent
+    while (poll() != TxIdle) {
+        if (WiznetBus::expired(start, timeout)) {
+            W5100_STAT_ADD(timeouts, 1);
+            return StatusTimeout;
+        }
+    }
+
+    // Wait for space in the transmit buffer
+    while (!sendFrameVAsync(segments, count))
+    {
+        W5100_STAT_ADD(tx_full_spins, 1);
+        if(getSn_SR() == WiznetRegisters::SOCK_CLOSED) {
+            return StatusClosed;
+        }
+        if (WiznetBus::expired(start, timeout)) {
+            W5100_STAT_ADD(timeouts, 1);
+            return StatusTimeout;
+        }
+    }
+
+    // Wait for our frame to be sent
+    while ((status = poll()) == TxBusy) {
+        if (WiznetBus::expired(start, timeout)) {
+            W5100_STAT_ADD(timeouts, 1);
+            return StatusTimeout;
+        }
+    }
+
+    if (status == TxTimeout) {
+        return StatusTxFailed;
+    }
+
+    return StatusOk;
+}
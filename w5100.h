@@ -36,6 +36,10 @@
 #include <stdint.h>
 #include <Arduino.h>
 
+#include "w5100_config.h"
+#include "w5100_bus.h"
+#include "w5100_regs.h"
+
 
 
 class Wiznet5100 {
@@ -43,10 +47,20 @@ class Wiznet5100 {
 public:
     /**
      * Constructor that uses the default hardware SPI pins
+     * The driver creates and owns a WiznetSpiBus, the first time this is used.
      * @param cs the Arduino Chip Select / Slave Select pin (default 10)
      */
     Wiznet5100(int8_t cs=SS);
 
+    /**
+     * Constructor that uses another bus to talk to the chip
+     * The bus is owned by the caller, and must last as long as the driver.
+     * @param bus the bus that the chip is connected to
+     */
+    Wiznet5100(WiznetBus &bus);
+
+    ~Wiznet5100();
+
 
     /**
      * Initialise the Ethernet controller
@@ -57,19 +71,369 @@ public:
      */
     boolean begin(const uint8_t *address);
 
+    /** Result of an operation that waits for the chip */
+    enum Status {
+        StatusOk = 0,       ///< The operation completed
+        StatusTimeout,      ///< The time allowed ran out, such as waiting for space in the transmit buffer
+        StatusTxFailed,     ///< The frame was sent to the chip, but it wasn't confirmed as sent
+        StatusClosed,       ///< The socket is closed
+        StatusTooLong,      ///< The frame is bigger than the transmit buffer
+        StatusNoResponse,   ///< The chip didn't complete a command; reinit() may bring it back
+        StatusUnresolved,   ///< The MAC address of the destination isn't known yet
+    };
+
+    /**
+     * Reset the chip and open the socket again, without setting up the bus
+     *
+     * This is the quick way back after StatusNoResponse, or any other sign
+     * that the chip has stopped working. Every wait is bounded, so it always
+     * returns in a few milliseconds. Frames in the transmit and receive
+     * buffers are lost, and a frame moving in the background is given up on.
+     *
+     * @return StatusOk, StatusNoResponse if the chip didn't complete the reset
+     *         or a command, StatusClosed if the socket didn't open, or
+     *         StatusTimeout if the chip is working again but a frame moving
+     *         in the background didn't finish in time and was cancelled
+     */
+    Status reinit();
+
     /**
      * Shut down the Ethernet controlled
+     * Waits for as long as was set with setTimeout().
      */
     void end();
 
+    /**
+     * Shut down the Ethernet controller, waiting no longer than given
+     * A frame moving in the background is given up on, and if it doesn't
+     * finish in time, the bus transfer is cancelled and StatusTimeout returned.
+     *
+     * @param timeout the most time to wait for the transfer to finish and the
+     *        socket to close, in microseconds
+     * @return StatusOk, StatusTimeout or StatusNoResponse
+     */
+    Status end(uint32_t timeout);
+
+    /**
+     * Set the time allowed for the operations that don't take a timeout
+     * These are sendFrame(), sendFrameV(), forwardFrame(), reflectFrame() and end().
+     * @param timeout the time in microseconds (default W5100_TIMEOUT)
+     */
+    void setTimeout(uint32_t timeout) { _timeout = timeout; }
+
+    /**
+     * Get the time allowed for the operations that don't take a timeout
+     * @return the time in microseconds, as set with setTimeout()
+     */
+    uint32_t timeout() const { return _timeout; }
+
+    /**
+     * Get the MAC address of the chip
+     * @return the 6-byte address given to begin()
+     */
+    const uint8_t *macAddress() const { return _mac_address; }
+
+    /**
+     * Get the length of the longest frame that can be sent
+     * @return the size of the transmit buffer, in bytes
+     */
+    static uint16_t maxFrameLength() { return TxBufferLength; }
+
+    /**
+     * Check whether the socket used for frames is open
+     * It is closed by end(), or when the chip has been reset behind the driver.
+     * @return true if frames can be sent and received
+     */
+    boolean isOpen() { return getSn_SR() != WiznetRegisters::SOCK_CLOSED; }
+
+    /**
+     * Set the IP address of the chip, for the sockets used by WiznetUdp
+     * Frames on socket 0 are not affected. The address is kept across reinit().
+     * @param address the 4-byte IP address
+     */
+    void setIPAddress(const uint8_t *address);
+
+    /**
+     * Set the gateway that WiznetUdp sends to, for addresses outside the subnet
+     * @param address the 4-byte IP address of the gateway
+     */
+    void setGateway(const uint8_t *address);
+
+    /**
+     * Read a 1 or 2 byte register of socket 1 to 3, for WiznetUdp
+     * Socket 0 belongs to the driver, so its registers are refused at compile time.
+     * @tparam Reg the register, from WiznetRegisters::Socket
+     * @return The value of the register
+     */
+    template <class Reg>
+    inline typename WiznetRegisters::Value<Reg::width>::type getSocketReg() {
+        static_assert(otherSocket(Reg::address), "Only the registers of sockets 1 to 3 can be used");
+        return getReg<Reg>();
+    }
+
+    /**
+     * Write a 1 or 2 byte register of socket 1 to 3, for WiznetUdp
+     * @tparam Reg the register, from WiznetRegisters::Socket
+     * @param value The value to write
+     */
+    template <class Reg>
+    inline void setSocketReg(typename WiznetRegisters::Value<Reg::width>::type value) {
+        static_assert(otherSocket(Reg::address), "Only the registers of sockets 1 to 3 can be used");
+        setReg<Reg>(value);
+    }
+
+    /**
+     * Write a register of socket 1 to 3 that is longer than 2 bytes, such as an address
+     * @tparam Reg the register, from WiznetRegisters::Socket
+     * @param buf Pointer to Reg::width bytes to write
+     */
+    template <class Reg>
+    inline void setSocketRegBuf(const uint8_t *buf) {
+        static_assert(otherSocket(Reg::address), "Only the registers of sockets 1 to 3 can be used");
+        setRegBuf<Reg>(buf);
+    }
+
+    /**
+     * Read a 16-bit counter register of socket 1 to 3 that the chip may be changing
+     * @tparam Reg the register, from WiznetRegisters::Socket
+     * @return the value once it reads the same twice in a row, or 0 if it didn't
+     */
+    template <class Reg>
+    inline uint16_t readSocketCounter() {
+        static_assert(otherSocket(Reg::address), "Only the registers of sockets 1 to 3 can be used");
+        return readCounter<Reg>();
+    }
+
+    /**
+     * Give a command to socket 1 to 3, then wait for it to execute
+     * @tparam Sn the socket number
+     * @param cr the command, such as WiznetRegisters::Sn_CR_SEND
+     * @return true, or false if the chip didn't complete it within WiznetBus::CommandTimeoutMicros
+     */
+    template <uint8_t Sn>
+    inline boolean sendSocketCommand(uint8_t cr) {
+        static_assert(Sn != 0 && Sn < WiznetRegisters::SocketCount, "Only sockets 1 to 3 can be used");
+        return socketCommand(Sn, cr);
+    }
+
+    /**
+     * Copy data into the transmit buffer of socket 1 to 3, wrapping round its end
+     * The buffers are the ones that W5100_TMSR gives to the socket.
+     * @tparam Sn the socket number
+     * @param ptr the Tx write pointer to start writing at
+     * @param data the data to copy
+     * @param len the length of the data
+     */
+    template <uint8_t Sn>
+    inline void writeSocketTx(uint16_t ptr, const uint8_t *data, uint16_t len) {
+        static_assert(Sn != 0 && Sn < WiznetRegisters::SocketCount, "Only sockets 1 to 3 can be used");
+        writeRing(WiznetRegisters::TxMemoryAddress + WiznetRegisters::bufferOffset(TxBufferSize, Sn),
+                  WiznetRegisters::bufferLength(TxBufferSize, Sn), ptr, data, len);
+    }
+
+    /**
+     * Copy data out of the receive buffer of socket 1 to 3, wrapping round its end
+     * The buffers are the ones that W5100_RMSR gives to the socket.
+     * @tparam Sn the socket number
+     * @param ptr the Rx read pointer to start reading at
+     * @param data the buffer to copy to
+     * @param len the length of the data
+     */
+    template <uint8_t Sn>
+    inline void readSocketRx(uint16_t ptr, uint8_t *data, uint16_t len) {
+        static_assert(Sn != 0 && Sn < WiznetRegisters::SocketCount, "Only sockets 1 to 3 can be used");
+        readRing(WiznetRegisters::RxMemoryAddress + WiznetRegisters::bufferOffset(RxBufferSize, Sn),
+                 WiznetRegisters::bufferLength(RxBufferSize, Sn), ptr, data, len);
+    }
+
+    /**
+     * Set the subnet mask, for deciding which addresses are sent to the gateway
+     * @param mask the 4-byte subnet mask
+     */
+    void setSubnetMask(const uint8_t *mask);
+
+    /**
+     * Find the fastest SPI clock that works, the next time begin() is called
+     *
+     * Starting at the clock the bus was set up with, and halving it each time,
+     * test patterns are written to and read back from the gateway and subnet
+     * registers and the transmit buffer. If the first clock fails, the clock
+     * used is one step slower than the fastest that passed, to leave a margin.
+     * begin() fails if no clock passes.
+     *
+     * @param enable true to calibrate the clock in begin()
+     */
+    void setClockCalibration(boolean enable);
+
+    /**
+     * Get the clock of the bus to the chip
+     * The SPI library may round it down to a clock that the microcontroller can make.
+     * @return the clock in Hz, or 0 if the bus doesn't have a clock
+     */
+    uint32_t spiClock() const { return _bus->clock(); }
+
     /**
      * Send an Ethernet frame
+     * @deprecated Kept for existing sketches. The failure value is -1 returned
+     * as a uint16_t, so it reads as 65535 rather than a negative number; new code
+     * should use sendFrame(const uint8_t *, uint16_t, uint32_t), which returns a Status.
+     *
      * @param data a pointer to the data to send
      * @param datalen the length of the data in the packet
-     * @return the number of bytes transmitted
+     * @return the number of bytes transmitted, or (uint16_t)-1 if it wasn't sent
+     *         within the time set with setTimeout()
      */
     uint16_t sendFrame(const uint8_t *data, uint16_t datalen);
 
+    /**
+     * Send an Ethernet frame, waiting no longer than given
+     *
+     * If the time runs out after the frame was copied to the chip, it is
+     * still sent, and poll() reports when it has gone.
+     *
+     * @param data a pointer to the data to send
+     * @param datalen the length of the data in the packet
+     * @param timeout the most time to wait, in microseconds
+     * @return StatusOk if the frame was sent, or why it wasn't
+     */
+    Status sendFrame(const uint8_t *data, uint16_t datalen, uint32_t timeout);
+
+    /** A piece of an Ethernet frame, for sending with sendFrameV() */
+    struct Segment {
+        const uint8_t *data;    ///< Pointer to the data in this piece of the frame
+        uint16_t len;           ///< Length of the data
+    };
+
+    /**
+     * Send an Ethernet frame made from several pieces
+     * Each segment is copied straight into the transmit buffer,
+     * so the frame doesn't need to be assembled in RAM first.
+     *
+     * @deprecated Kept for existing sketches, like sendFrame(const uint8_t *, uint16_t).
+     * New code should use sendFrameV(const Segment *, uint8_t, uint32_t).
+     *
+     * @param segments the pieces of the frame, in order
+     * @param count the number of segments
+     * @return the number of bytes transmitted, or (uint16_t)-1 if it wasn't sent
+     *         within the time set with setTimeout()
+     */
+    uint16_t sendFrameV(const Segment *segments, uint8_t count);
+
+    /**
+     * Send an Ethernet frame made from several pieces, waiting no longer than given
+     * @param segments the pieces of the frame, in order
+     * @param count the number of segments
+     * @param timeout the most time to wait, in microseconds
+     * @return StatusOk if the frame was sent, or why it wasn't
+     * @sa sendFrame(const uint8_t *, uint16_t, uint32_t)
+     */
+    Status sendFrameV(const Segment *segments, uint8_t count, uint32_t timeout);
+
+    /** Transmit status returned by poll() */
+    enum TxStatus {
+        TxIdle = 0,     ///< Nothing being sent
+        TxBusy,         ///< A frame is still being sent
+        TxComplete,     ///< A frame has been sent
+        TxTimeout,      ///< A frame failed to send
+    };
+
+    /**
+     * Start sending an Ethernet frame without waiting for it to be transmitted
+     *
+     * The frame is copied into the transmit buffer straight away. If another
+     * frame is still being transmitted, it is queued behind it and sent by poll().
+     * Only one frame can be queued at a time.
+     *
+     * @param data a pointer to the data to send
+     * @param datalen the length of the data in the packet
+     * @return true if the frame was queued,
+     *         false if the queue or the transmit buffer is full
+     */
+    boolean sendFrameAsync(const uint8_t *data, uint16_t datalen);
+
+    /**
+     * Start sending an Ethernet frame made from several pieces,
+     * without waiting for it to be transmitted
+     *
+     * @param segments the pieces of the frame, in order
+     * @param count the number of segments
+     * @return true if the frame was queued,
+     *         false if the queue or the transmit buffer is full
+     * @sa sendFrameAsync()
+     */
+    boolean sendFrameVAsync(const Segment *segments, uint8_t count);
+
+    /**
+     * Check for the completion of asynchronous frames and send the next queued frame
+     * Must be called regularly while frames are being sent with sendFrameAsync()
+     *
+     * @return TxComplete or TxTimeout when a frame has finished,
+     *         TxBusy if still waiting, or TxIdle if nothing is being sent
+     */
+    TxStatus poll();
+
+    /**
+     * Called from poll() when a frame given to submitReceive() or submitSend()
+     * has finished moving between RAM and the chip
+     * @param len the length of the frame, or 0 if reinit() or end() abandoned it
+     * @param context the pointer that was passed with the frame
+     */
+    typedef void (*TransferCallback)(uint16_t len, void *context);
+
+    /**
+     * Start reading a received frame, and carry on while it is copied
+     *
+     * Only the length and Ethernet header are read straight away. The rest of
+     * the frame is copied by the bus in the background, if it can, and the
+     * frame is released and done called once poll() sees that it has finished.
+     * Only one frame can be moving at a time.
+     *
+     * @param buffer the buffer to copy the frame to, which mustn't be used until done is called
+     * @param bufsize the available space in the buffer
+     * @param done the function to call with the length of the frame
+     * @param context a pointer to pass to done
+     * @return true if a frame is being read, or false if none was received,
+     *         it was too big for the buffer and dropped, or a frame is already moving
+     */
+    boolean submitReceive(uint8_t *buffer, uint16_t bufsize, TransferCallback done, void *context = NULL);
+
+    /**
+     * Start copying a frame to the transmit buffer, and carry on while it is copied
+     * Once poll() sees that it has been copied, it is sent, or queued as with
+     * sendFrameAsync(), and done is called.
+     *
+     * @param data the frame, which mustn't be changed until done is called
+     * @param datalen the length of the frame
+     * @param done the function to call with the length of the frame
+     * @param context a pointer to pass to done
+     * @return true if the frame is being copied, or false if there isn't space
+     *         for it yet or a frame is already moving
+     */
+    boolean submitSend(const uint8_t *data, uint16_t datalen, TransferCallback done, void *context = NULL);
+
+    /**
+     * Check whether a frame from submitReceive() or submitSend() is still moving
+     * @return true until its callback has been called
+     */
+    boolean transferBusy() const { return _async_op != AsyncIdle; }
+
+    /**
+     * Use the W5100 INT pin to find out when frames have been received or sent
+     *
+     * Once enabled, readFrame() and poll() only access the chip after
+     * the interrupt has fired, rather than polling its registers over SPI.
+     * Only one Wiznet5100 can use interrupts at a time.
+     *
+     * @param pin the Arduino pin connected to the INT pin of the W5100
+     * @return true if the pin supports interrupts
+     */
+    boolean enableInterrupt(uint8_t pin);
+
+    /**
+     * Go back to polling the chip for received and sent frames
+     */
+    void disableInterrupt();
+
     /**
      * Read an Ethernet frame
      * @param buffer a pointer to a buffer to write the packet to
@@ -79,47 +443,622 @@ public:
      */
     uint16_t readFrame(uint8_t *buffer, uint16_t bufsize);
 
+    /**
+     * Get the number of received frames that were rejected by the
+     * frame filter without reading their payload
+     * These are counted whether or not W5100_STATS is set, and are
+     * also reported as Stats::rx_filtered.
+     * @return the number of frames skipped
+     */
+    uint32_t filteredFrames() const { return _filtered_frames; }
+
+    /**
+     * Get the number of payload bytes that were skipped in the receive buffer,
+     * rather than being copied over SPI, because the frame was rejected
+     * @return the number of bytes not copied
+     */
+    uint32_t filteredBytes() const { return _filtered_bytes; }
+
+    /**
+     * Read all of the complete frames waiting in the receive buffer
+     *
+     * The frames are packed one after another into buffer, and the receive
+     * buffer is released with a single RECV command once they have all been read.
+     * Frames that do not fit in the remaining space are left for the next call.
+     *
+     * @param buffer a pointer to a buffer to write the packets to
+     * @param bufsize the available space in the buffer
+     * @param lengths an array to write the length of each packet to
+     * @param maxframes the number of entries in the lengths array
+     * @return the number of packets received
+     */
+    uint8_t readFrames(uint8_t *buffer, uint16_t bufsize, uint16_t *lengths, uint8_t maxframes);
+
+    /**
+     * A received Ethernet frame that is read from the receive buffer a piece at a time
+     * @sa beginFrame()
+     */
+    class FrameReader {
+    public:
+        FrameReader() : _driver(NULL), _length(0), _pos(0) {}
+
+        /**
+         * Check whether a frame was received
+         * @return true if there is a frame to read
+         */
+        explicit operator bool() const { return _driver != NULL; }
+
+        /**
+         * Get the length of the whole frame
+         * @return the length of the frame in bytes
+         */
+        uint16_t length() const { return _length; }
+
+        /**
+         * Get the number of bytes of the frame that have not been read or skipped yet
+         * @return the number of bytes remaining
+         */
+        uint16_t remaining() const { return _length - _pos; }
+
+        /**
+         * Get the Ethernet header of the frame, without using the bus
+         * @return a pointer to the first 14 bytes of the frame
+         */
+        const uint8_t *header() const { return _header; }
+
+        /**
+         * Read the next part of the frame
+         * @param dst a pointer to a buffer to write the data to
+         * @param n the number of bytes to read
+         * @return the number of bytes read
+         */
+        uint16_t read(uint8_t *dst, uint16_t n);
+
+        /**
+         * Skip over the next part of the frame without reading it
+         * @param n the number of bytes to skip
+         * @return the number of bytes skipped
+         */
+        uint16_t skip(uint16_t n);
+
+        /**
+         * Finish with the frame, and release its space in the receive buffer
+         * Must be called before the next frame is read.
+         */
+        void end();
+
+    private:
+        friend class Wiznet5100;
+
+        /**
+         * Read part of the frame, without changing the current position
+         * @param offset the position in the frame to read from
+         * @param dst a pointer to a buffer to write the data to
+         * @param n the number of bytes to read
+         */
+        void readAt(uint16_t offset, uint8_t *dst, uint16_t n);
+
+        Wiznet5100 *_driver;
+        uint16_t _start;        /* Rx pointer to the start of the frame */
+        uint16_t _length;
+        uint16_t _pos;
+        uint16_t _after;        /* Bytes received after the frame */
+        uint8_t _header[14];
+    };
+
+    /**
+     * Start reading an Ethernet frame
+     *
+     * Only the Ethernet header is read from the chip. The rest of the frame
+     * is read in pieces with FrameReader::read(), so frames larger
+     * than the available RAM can be handled.
+     *
+     * @return the frame, which is false if no frame was received
+     */
+    FrameReader beginFrame();
+
+    /**
+     * Callback to modify a frame while it is being forwarded
+     * @param data a piece of the frame, which can be changed
+     * @param offset the position of the piece within the frame
+     * @param len the length of the piece
+     * @param context the pointer that was passed to forwardFrame()
+     */
+    typedef void (*RewriteCallback)(uint8_t *data, uint16_t offset, uint16_t len, void *context);
+
+    /**
+     * Send a received frame, copying it from the receive buffer to the transmit buffer
+     *
+     * The frame is moved through a small buffer a piece at a time, so it is never
+     * held in RAM all at once. The first piece always holds the Ethernet header.
+     * This waits for space in the transmit buffer, but not for the frame to be sent -
+     * poll() must be called to send it. The received frame is released.
+     *
+     * @param frame the received frame, from beginFrame()
+     * @param rewrite a function to modify each piece of the frame, or NULL
+     * @param context a pointer to pass to the rewrite function
+     * @return true if the frame was queued, or false if the socket has closed
+     *         or the reader has no frame
+     */
+    boolean forwardFrame(FrameReader &frame, RewriteCallback rewrite = NULL, void *context = NULL);
+
+    /**
+     * Send a received frame back to where it came from
+     * Like forwardFrame(), but the destination is set to the source of the frame
+     * and the source is set to our MAC address, before the rewrite function is called.
+     *
+     * @param frame the received frame, from beginFrame()
+     * @param rewrite a function to modify each piece of the frame, or NULL
+     * @param context a pointer to pass to the rewrite function
+     * @return true if the frame was queued, or false if the socket has closed
+     */
+    boolean reflectFrame(FrameReader &frame, RewriteCallback rewrite = NULL, void *context = NULL);
+
+    /**
+     * An Ethernet frame that is written into the transmit buffer a piece at a time
+     * @sa beginSendFrame()
+     */
+    class FrameWriter {
+    public:
+        FrameWriter() : _driver(NULL), _length(0), _pos(0) {}
+
+        /**
+         * Check whether space was reserved for a frame
+         * @return true if the frame can be written
+         */
+        explicit operator bool() const { return _driver != NULL; }
+
+        /**
+         * Get the number of bytes written so far
+         * @return the length of the frame in bytes
+         */
+        uint16_t length() const { return _pos; }
+
+        /**
+         * Get the number of bytes that can still be written
+         * @return the space remaining
+         */
+        uint16_t remaining() const { return _length - _pos; }
+
+        /**
+         * Add data to the end of the frame
+         * @param src a pointer to the data
+         * @param n the number of bytes to write
+         * @return the number of bytes written, which is less than n if there isn't room
+         */
+        uint16_t write(const uint8_t *src, uint16_t n);
+
+        /**
+         * Change data that has already been written, such as a checksum
+         * @param offset the position in the frame to write at
+         * @param src a pointer to the data
+         * @param n the number of bytes to write, which must already have been written
+         */
+        void writeAt(uint16_t offset, const uint8_t *src, uint16_t n);
+
+        /**
+         * Send the frame, or queue it if another frame is being sent
+         * Like sendFrameAsync(), poll() must be called to finish sending it.
+         */
+        void send();
+
+        /**
+         * Give up on the frame without sending it, and free its space
+         */
+        void cancel();
+
+    private:
+        friend class Wiznet5100;
+
+        Wiznet5100 *_driver;
+        uint16_t _start;        /* Tx pointer to the start of the frame */
+        uint16_t _length;       /* Space reserved */
+        uint16_t _pos;
+    };
+
+    /**
+     * Start writing an Ethernet frame straight into the transmit buffer
+     *
+     * This doesn't wait: if there isn't space yet, poll() must be called
+     * and it tried again. Until the frame is sent or cancelled, the space
+     * is held for it, and other frames fail or wait as if the buffer were full.
+     * reinit() frees the space, and the frame must not be sent after it.
+     *
+     * @param maxlen the most bytes that will be written
+     * @return the frame, which is false if there isn't space for it
+     */
+    FrameWriter beginSendFrame(uint16_t maxlen);
+
+    /**
+     * Only accept received frames with this EtherType
+     * With no EtherTypes added, frames of every EtherType are accepted.
+     * Tagged frames are matched on their outer EtherType, such as 0x8100.
+     *
+     * @param ethertype the EtherType, such as 0x0800 for IPv4
+     * @return true if it was added, or false if the list is full
+     */
+    boolean addEtherType(uint16_t ethertype);
+
+    /**
+     * Accept received frames of every EtherType again
+     */
+    void clearEtherTypes();
+
+    /**
+     * Choose whether to accept frames sent to the broadcast address
+     * @param accept true to accept broadcast frames (the default)
+     */
+    void setBroadcast(boolean accept);
+
+    /**
+     * Accept frames sent to a multicast address
+     * Like a real NIC, addresses are hashed into 64 bins,
+     * so some other multicast addresses will get through too.
+     *
+     * @param address the 6-byte multicast MAC address
+     */
+    void addMulticastAddress(const uint8_t *address);
+
+    /**
+     * Reject all multicast frames, until addMulticastAddress() is called
+     */
+    void clearMulticastAddresses();
+
+    /**
+     * Accept all multicast frames (the default)
+     */
+    void acceptAllMulticast();
+
+    /**
+     * Ask the chip to drop frames that are not for our MAC address or broadcast
+     *
+     * The @ref WiznetRegisters::Sn_MR_MF bit is set when the socket is opened by begin(),
+     * but only if no multicast frames are wanted, because it drops them too.
+     * The driver still checks every frame, so chips that ignore the bit
+     * receive the same frames, just with more bus traffic.
+     *
+     * @param enable true to use the filter in the chip
+     */
+    void setHardwareFilter(boolean enable);
+
+#if W5100_POOL_FRAMES
+    /**
+     * A frame buffer from the driver's frame pool
+     * Handles are small, so they can be queued and passed around instead of frames.
+     */
+    typedef uint8_t FrameHandle;
+
+    /** The handle returned when there is no frame */
+    static const FrameHandle NoFrame = 0xFF;
+
+    /**
+     * A first-in first-out queue of frames from the pool
+     * It holds handles, so frames are not copied when they are queued,
+     * and it has room for every frame in the pool.
+     */
+    class FrameQueue {
+    public:
+        FrameQueue() : _head(0), _count(0) {}
+
+        /**
+         * Add a frame to the back of the queue
+         * @param frame the frame
+         * @return false if the queue is full
+         */
+        boolean push(FrameHandle frame);
+
+        /**
+         * Take the frame from the front of the queue
+         * @return the frame, or NoFrame if the queue is empty
+         */
+        FrameHandle pop();
+
+        /**
+         * Get the frame at the front of the queue, without taking it
+         * @return the frame, or NoFrame if the queue is empty
+         */
+        FrameHandle peek() const { return _count ? _frames[_head] : NoFrame; }
+
+        /**
+         * Get the number of frames in the queue
+         * @return the number of frames
+         */
+        uint8_t count() const { return _count; }
+
+        /**
+         * Check whether the queue is empty
+         * @return true if there are no frames in the queue
+         */
+        boolean empty() const { return _count == 0; }
+
+    private:
+        FrameHandle _frames[W5100_POOL_FRAMES];
+        uint8_t _head;
+        uint8_t _count;
+    };
+
+    /**
+     * Take a frame buffer from the pool
+     * @return the frame, or NoFrame if they are all in use
+     */
+    FrameHandle allocFrame();
+
+    /**
+     * Give a frame buffer back to the pool
+     * @param frame the frame, which must not be used again
+     */
+    void freeFrame(FrameHandle frame);
+
+    /**
+     * Get the data in a frame buffer
+     * @param frame the frame
+     * @return a pointer to the W5100_POOL_FRAME_SIZE bytes of the buffer
+     */
+    uint8_t *frameData(FrameHandle frame) { return _pool[frame]; }
+
+    /**
+     * Get the length of the frame in a frame buffer
+     * @param frame the frame
+     * @return the length in bytes
+     */
+    uint16_t frameLength(FrameHandle frame) const { return _pool_length[frame]; }
+
+    /**
+     * Set the length of the frame in a frame buffer
+     * @param frame the frame
+     * @param len the length in bytes
+     */
+    void setFrameLength(FrameHandle frame, uint16_t len) { _pool_length[frame] = len; }
+
+    /**
+     * Get the number of frame buffers that are not in use
+     * @return the number of free buffers
+     */
+    uint8_t framesFree() const { return W5100_POOL_FRAMES - _pool_used; }
+
+    /**
+     * Read an Ethernet frame into a buffer from the pool
+     * Nothing is read from the chip if the pool is empty.
+     *
+     * @return the frame, or NoFrame if no frame was received
+     */
+    FrameHandle readFrame();
+
+    /**
+     * Send a frame from the pool, and give it back to the pool
+     * Built on sendFrame(const uint8_t *, uint16_t), so it fails the same way.
+     * @param frame the frame, with its length set
+     * @return the number of bytes transmitted, or (uint16_t)-1 if it wasn't sent
+     */
+    uint16_t sendFrame(FrameHandle frame);
+
+    /**
+     * Start sending a frame from the pool, without waiting for it to be transmitted
+     * The frame is given back to the pool once it has been copied to the transmit buffer.
+     *
+     * @param frame the frame, with its length set
+     * @return true if the frame was queued and freed,
+     *         false if it wasn't and the frame is still owned by the caller
+     * @sa sendFrameAsync()
+     */
+    boolean sendFrameAsync(FrameHandle frame);
+#endif
+
+#if W5100_STATS
+    /** Driver statistics, for finding out where frames and time go */
+    struct Stats {
+        uint32_t rx_frames;         ///< Frames received and passed to the application
+        uint32_t rx_bytes;          ///< Bytes in the frames received
+        uint32_t rx_oversize;       ///< Frames dropped because they were bigger than the buffer
+        uint32_t rx_runts;          ///< Frames dropped because they were shorter than an Ethernet header
+        uint32_t rx_filtered;       ///< Frames rejected by the frame filter
+        uint32_t rx_filtered_bytes; ///< Payload bytes skipped, rather than copied, for rejected frames
+        uint32_t tx_frames;         ///< Frames sent
+        uint32_t tx_bytes;          ///< Bytes in the frames sent
+        uint32_t tx_timeouts;       ///< Frames that were not confirmed as sent
+        uint32_t tx_full_spins;     ///< Times round the loop waiting for space in the transmit buffer
+        uint32_t cmd_waits;         ///< Times round the loop waiting for a socket command to complete
+        uint32_t cmd_timeouts;      ///< Socket commands that the chip didn't complete in time
+        uint32_t timeouts;          ///< Operations that gave up because their time ran out
+        uint32_t bus_transactions;  ///< Transactions on the bus to the chip
+#if W5100_POOL_FRAMES
+        uint32_t pool_high_water;   ///< Most frame buffers in use at once
+        uint32_t pool_exhausted;    ///< Times a frame buffer was wanted when none were free
+#endif
+    };
+
+    /**
+     * Take a copy of the driver statistics
+     * @param stats the structure to copy the statistics to
+     */
+    void getStats(Stats &stats) const;
+
+    /**
+     * Reset all of the driver statistics to zero
+     */
+    void resetStats();
+#endif
+
+#if W5100_TRACE
+    /** Events recorded in the trace buffer */
+    enum TraceEvent {
+        TraceRxDetected = 1,    ///< Data found in the receive buffer (length: bytes waiting)
+        TraceRxHeader,          ///< Ethernet header read (length: frame length)
+        TraceRxPayload,         ///< Rest of the frame copied (length: frame length)
+        TraceRxCommit,          ///< Rx read pointer written and RECV done (length: bytes still waiting)
+        TraceTxStart,           ///< Blocking send started (length: frame length)
+        TraceTxReserved,        ///< Space found in the transmit buffer (length: frame length)
+        TraceTxQueued,          ///< Frame copied to the transmit buffer (length: frame length)
+        TraceTxSend,            ///< SEND command done (length: frame length)
+        TraceTxSendOk,          ///< SENDOK seen (length: frame length)
+        TraceTxTimeout,         ///< Frame timed out (length: frame length)
+    };
+
+    /**
+     * Write the trace buffer to a stream in binary form, and empty it
+     *
+     * The dump starts with an 8-byte header: "W5TR", the format version (1),
+     * the record length (7) and the number of records (16-bit little endian).
+     * Each record is the micros() time (32-bit), the TraceEvent (8-bit) and
+     * the length (16-bit), all little endian, oldest first.
+     * The tracedump programme decodes it.
+     *
+     * @param out the stream to write to, such as Serial
+     */
+    void dumpTrace(Print &out);
+#endif
+
 
 private:
-    static const uint16_t TxBufferAddress = 0x4000;  /* Internal Tx buffer address of the iinchip */
-    static const uint16_t RxBufferAddress = 0x6000;  /* Internal Rx buffer address of the iinchip */
-    static const uint8_t TxBufferSize = 0x3; /* Buffer size configuration: 0=1kb, 1=2kB, 2=4kB, 3=8kB */
-    static const uint8_t RxBufferSize = 0x3; /* Buffer size configuration: 0=1kb, 1=2kB, 2=4kB, 3=8kB */
-    static const uint16_t TxBufferLength = (1 << TxBufferSize) << 10; /* Length of Tx buffer in bytes */
-    static const uint16_t RxBufferLength = (1 << RxBufferSize) << 10; /* Length of Rx buffer in bytes */
+
+    static const uint8_t TxBufferSize = W5100_TMSR; /* TMSR value (2 bits per socket: 0=1kB, 1=2kB, 2=4kB, 3=8kB) */
+    static const uint8_t RxBufferSize = W5100_RMSR; /* RMSR value */
+    static const uint16_t TxBufferAddress = WiznetRegisters::TxMemoryAddress + WiznetRegisters::bufferOffset(TxBufferSize, 0);
+    static const uint16_t RxBufferAddress = WiznetRegisters::RxMemoryAddress + WiznetRegisters::bufferOffset(RxBufferSize, 0);
+    static const uint16_t TxBufferLength = WiznetRegisters::bufferLength(TxBufferSize, 0); /* Length of Tx buffer in bytes */
+    static const uint16_t RxBufferLength = WiznetRegisters::bufferLength(RxBufferSize, 0); /* Length of Rx buffer in bytes */
     static const uint16_t TxBufferMask = TxBufferLength - 1;
     static const uint16_t RxBufferMask = RxBufferLength - 1;
+    static const uint16_t EthernetHeaderLength = 14; /* Destination, Source and EtherType */
+    static const uint32_t TxTimeoutMicros = 100000; /* Microseconds to wait for a frame to be sent */
+    static const uint8_t RegisterReadTries = 8; /* Attempts at reading a 16-bit counter the same twice */
+    static const uint8_t InterruptClearTries = 4; /* Attempts at clearing Sn_IR in interrupt mode */
+
+    /** @return true if address is a register of socket 1 to 3, rather than the driver's */
+    static constexpr bool otherSocket(uint16_t address) {
+        return address >= WiznetRegisters::SocketBase + WiznetRegisters::SocketStride &&
+               address < WiznetRegisters::SocketBase + WiznetRegisters::SocketCount * WiznetRegisters::SocketStride;
+    }
+    static const uint16_t ForwardChunkSize = 64; /* Bytes copied at a time by forwardFrame() */
+    static const uint32_t MinCalibrationClock = 250000; /* Slowest SPI clock tried by calibrateClock() */
+    static const uint8_t CalibrationRounds = 4;   /* Times the test patterns must pass at each clock */
 
+    static_assert(WiznetRegisters::bufferFits(TxBufferSize, 0), "Socket 0 Tx buffer doesn't fit in the Tx memory");
+    static_assert(WiznetRegisters::bufferFits(RxBufferSize, 0), "Socket 0 Rx buffer doesn't fit in the Rx memory");
+    static_assert(ForwardChunkSize <= TxBufferLength, "forwardFrame() chunks must fit in the Tx buffer");
 
-    int8_t _cs;
+
+    WiznetBus *_bus;
+    WiznetSpiBus *_own_bus;  /* The bus made by Wiznet5100(int8_t cs), or NULL if the caller owns it */
     uint8_t _mac_address[6];
+    uint8_t _ip_address[4];
+    uint8_t _gateway[4];
+    uint8_t _subnet_mask[4];
+    uint32_t _filtered_frames;
+    uint32_t _filtered_bytes;
+#if W5100_STATS
+    Stats _stats;
+#endif
+
+#if W5100_TRACE
+    struct TraceRecord {
+        uint32_t time;
+        uint16_t length;
+        uint8_t event;
+    };
+
+    TraceRecord _trace[W5100_TRACE_SIZE];
+    uint8_t _trace_next;     /* Index of the next record to write */
+    uint8_t _trace_count;    /* Number of records in the buffer */
 
     /**
-     * Default function to select chip.
-     * @note This function help not to access wrong address. If you do not describe this function or register any functions,
-     * null function is called.
+     * Add an event to the trace buffer, overwriting the oldest if it is full
+     * @param event the TraceEvent
+     * @param length the frame length or byte count for the event
      */
-    inline void wizchip_cs_select()
-    {
-        digitalWrite(_cs, LOW);
-    }
+    void trace(uint8_t event, uint16_t length);
+#endif
+
+#if W5100_POOL_FRAMES
+    uint8_t _pool[W5100_POOL_FRAMES][W5100_POOL_FRAME_SIZE];
+    uint16_t _pool_length[W5100_POOL_FRAMES];
+    uint8_t _pool_next[W5100_POOL_FRAMES]; /* Next buffer in the free list */
+    uint8_t _pool_free;                    /* First free buffer, or NoFrame */
+    uint8_t _pool_used;                    /* Number of buffers in use */
+#endif
+
+    boolean _tx_sending;     /* A SEND command is in progress */
+    uint16_t _tx_len;        /* Length of the frame being sent */
+    uint16_t _tx_queued;     /* Length of the frame waiting behind it, or 0 */
+    boolean _tx_reserved;    /* A FrameWriter holds the space after _tx_wr */
+    uint16_t _tx_wr;         /* Tx write pointer after the last frame copied */
+    uint16_t _tx_free;       /* Space known to be free in the Tx buffer after _tx_wr */
+    uint32_t _tx_started;    /* micros() when the last SEND command was issued */
+
+    uint16_t _ethertypes[W5100_ETHERTYPE_FILTER_SIZE]; /* EtherTypes to accept */
+    uint8_t _ethertype_count;   /* Number of EtherTypes in the list, or 0 to accept all */
+    uint8_t _multicast_hash[8]; /* One bit for each multicast hash bin to accept */
+    boolean _accept_broadcast;
+    boolean _hw_filter;         /* Use Sn_MR_MF when no multicast is wanted */
+
+    boolean _calibrate_clock; /* Find the fastest working SPI clock in begin() */
+    uint32_t _timeout;       /* Microseconds allowed for operations that don't take a timeout */
+
+    /** Frames moving in the background */
+    enum {
+        AsyncIdle = 0,
+        AsyncReceiving,
+        AsyncSending,
+    };
+
+    uint8_t _async_op;              /* What the frame moving in the background is for */
+    volatile boolean _async_done;   /* The bus has finished moving it */
+    uint16_t _async_len;            /* Length of the frame */
+    boolean _async_write;
+    uint16_t _async_base;           /* Buffer address that the second piece starts at */
+    const uint8_t *_async_rest;     /* RAM for the second piece, after wrapping round the buffer */
+    uint16_t _async_rest_len;       /* Length of the second piece, or 0 */
+    FrameReader _async_frame;       /* The frame being received */
+    TransferCallback _async_callback;
+    void *_async_context;
+
+    int8_t _int_pin;         /* Pin connected to INT, or -1 when polling */
+    uint8_t _sn_ir;          /* Socket interrupts latched from Sn_IR */
+    static volatile boolean _irq_fired;
+
+    /* Copies would share, and both delete, the bus made by Wiznet5100(int8_t cs) */
+    Wiznet5100(const Wiznet5100 &) = delete;
+    Wiznet5100 &operator=(const Wiznet5100 &) = delete;
 
     /**
-     * Default function to deselect chip.
-     * @note This function help not to access wrong address. If you do not describe this function or register any functions,
-     * null function is called.
+     * Set the initial state of the driver, for both constructors
+     * once they have set _bus and _own_bus
      */
-    inline void wizchip_cs_deselect()
-    {
-        digitalWrite(_cs, HIGH);
-    }
+    void init();
+
+    /**
+     * Find the fastest bus clock that passes testBus()
+     * @return true if a clock was found, or the bus doesn't have a clock
+     */
+    boolean calibrateClock();
+
+    /**
+     * Write test patterns to the chip and read them back
+     * GAR and SUBR are left cleared afterwards.
+     * @return true if everything read back correctly
+     */
+    boolean testBus();
+
+    /**
+     * Interrupt handler for the INT pin
+     */
+    static void isr();
+
+    /**
+     * Read and clear @ref Sn_IR, adding the bits to the latched socket interrupts
+     * @note In interrupt mode the chip is only read after the INT pin has fired.
+     * @return uint8_t. The latched socket interrupts.
+     */
+    uint8_t getSocketInterrupts();
 
     /**
      * Read a 1 byte value from a register.
      * @param address Register address
      * @return The value of register
      */
-    uint8_t wizchip_read(uint16_t address);
+    inline uint8_t wizchip_read(uint16_t address) {
+        return _bus->read(address);
+    }
 
     /**
      * Reads a 2 byte value from a register.
@@ -134,7 +1073,9 @@ private:
      * @param pBuf Pointer buffer to read data
      * @param len Data length
      */
-    void wizchip_read_buf(uint16_t address, uint8_t* pBuf, uint16_t len);
+    inline void wizchip_read_buf(uint16_t address, uint8_t* pBuf, uint16_t len) {
+        _bus->readBuf(address, pBuf, len);
+    }
 
     /**
      * Write a 1 byte value to a register.
@@ -142,7 +1083,9 @@ private:
      * @param wb Write data
      * @return void
      */
-    void wizchip_write(uint16_t address, uint8_t wb);
+    inline void wizchip_write(uint16_t address, uint8_t wb) {
+        _bus->write(address, wb);
+    }
 
     /**
      * Write a 2 byte value to a register.
@@ -158,155 +1101,277 @@ private:
      * @param pBuf Pointer buffer to write data
      * @param len Data length
      */
-    void wizchip_write_buf(uint16_t address, const uint8_t* pBuf, uint16_t len);
+    inline void wizchip_write_buf(uint16_t address, const uint8_t* pBuf, uint16_t len) {
+        _bus->writeBuf(address, pBuf, len);
+    }
 
 
     /**
      * Reset WIZCHIP by softly.
+     * @return true, or false if the reset didn't complete within WiznetBus::CommandTimeoutMicros
      */
-    void wizchip_sw_reset(void);
+    boolean wizchip_sw_reset(void);
 
     /**
-     * It copies data to internal TX memory
+     * It copies data to internal TX memory at a given write pointer
      *
-     * @details This function reads the Tx write pointer register and after that,
-     * it copies the <i>wizdata(pointer buffer)</i> of the length of <i>len(variable)</i> bytes to internal TX memory
-     * and updates the Tx write pointer register.
-     * This function is being called by send() and sendto() function also.
+     * @details This does not access the Tx write pointer register,
+     * so the data can be copied before it is ready to be sent.
      *
+     * @param ptr Tx write pointer to start writing at
      * @param wizdata Pointer buffer to write data
      * @param len Data length
-     * @sa wizchip_recv_data()
      */
-    void wizchip_send_data(const uint8_t *wizdata, uint16_t len);
+    void wizchip_write_tx(uint16_t ptr, const uint8_t *wizdata, uint16_t len);
 
     /**
-     * It copies data to your buffer from internal RX memory
+     * Copy data into a socket buffer, wrapping round its end
+     * @param base the address of the buffer
+     * @param length the length of the buffer, a power of 2
+     * @param ptr the buffer pointer to start writing at
+     * @param data the data to copy
+     * @param len the length of the data
+     */
+    void writeRing(uint16_t base, uint16_t length, uint16_t ptr, const uint8_t *data, uint16_t len);
+
+    /**
+     * Copy data out of a socket buffer, wrapping round its end
+     * @param base the address of the buffer
+     * @param length the length of the buffer, a power of 2
+     * @param ptr the buffer pointer to start reading at
+     * @param data the buffer to copy the data to
+     * @param len the length of the data
+     */
+    void readRing(uint16_t base, uint16_t length, uint16_t ptr, uint8_t *data, uint16_t len);
+
+    /**
+     * It copies data to your buffer from internal RX memory at a given read pointer
      *
-     * @details This function read the Rx read pointer register and after that,
-     * it copies the received data from internal RX memory
-     * to <i>wizdata(pointer variable)</i> of the length of <i>len(variable)</i> bytes.
-     * This function is being called by recv() also.
+     * @details This does not access the Rx read pointer register,
+     * so several frames can be read before the pointer is updated.
      *
+     * @param ptr Rx read pointer to start reading at
      * @param wizdata Pointer buffer to read data
      * @param len Data length
-     * @sa wizchip_send_data()
      */
-    void wizchip_recv_data(uint8_t *wizdata, uint16_t len);
+    void wizchip_read_rx(uint16_t ptr, uint8_t *wizdata, uint16_t len);
 
     /**
-     * It discard the received data in RX memory.
-     * @details It discards the data of the length of <i>len(variable)</i> bytes in internal RX memory.
-     * @param len Data length
+     * Get the number of bytes waiting in the receive buffer
+     * @note In interrupt mode the chip is only read after a RECV interrupt,
+     *       and while a frame is moving in the background it isn't read at all.
+     * @return the value of @ref Sn_RX_RSR, or 0
+     */
+    uint16_t rxAvailable();
+
+    /**
+     * Read the length prefix of a frame in the receive buffer
+     * @param ptr Rx read pointer of the frame
+     * @param len the number of bytes received from ptr onwards
+     * @return the length of the frame including the 2-byte prefix,
+     *         or 0 if there isn't a complete frame
+     */
+    uint16_t rxFrameLength(uint16_t ptr, uint16_t len);
+
+    /**
+     * Update the Rx read pointer and release the data before it
+     * @param ptr the new Rx read pointer
+     * @param len the number of bytes still received after ptr
+     */
+    void rxRelease(uint16_t ptr, uint16_t len);
+
+    /**
+     * Copy a received frame to the transmit buffer and queue it
+     * @sa forwardFrame(), reflectFrame()
+     */
+    boolean copyFrame(FrameReader &frame, boolean reflect, RewriteCallback rewrite, void *context);
+
+    /**
+     * Start moving data between RAM and a socket buffer in the background,
+     * wrapping round the end of the buffer like writeRing() and readRing()
+     * @param write true to copy to the buffer, false to copy from it
+     * @param base the address of the buffer
+     * @param length the length of the buffer, a power of 2
+     * @param ptr the buffer pointer to start at
+     * @param data the RAM to copy from or to
+     * @param len the length of the data
+     */
+    void startTransfer(boolean write, uint16_t base, uint16_t length, uint16_t ptr, const uint8_t *data, uint16_t len);
+
+    /**
+     * Bus completion for each piece of a background transfer
+     * @param context the Wiznet5100
+     */
+    static void transferPieceDone(void *context);
+
+    /**
+     * Send or release a frame that has finished moving, and call its callback
      */
-    void wizchip_recv_ignore(uint16_t len);
+    void completeTransfer();
+
+    /**
+     * Give up on a frame moving in the background, once the bus has finished
+     * with its buffer, and call its callback with a length of 0
+     * If the time runs out first, the bus transfer is cancelled instead.
+     * @param start micros() when the caller started waiting
+     * @param timeout the time allowed from start, in microseconds
+     * @return StatusOk, or StatusTimeout if the transfer had to be cancelled
+     */
+    Status abortTransfer(uint32_t start, uint32_t timeout);
+
+    /**
+     * Reserve space in the transmit buffer for a frame
+     * @param len the length of the frame
+     * @param ptr set to the Tx write pointer to copy the frame to
+     * @return true if there is space, false if the buffer or queue is full
+     * @sa txCommit()
+     */
+    boolean txReserve(uint16_t len, uint16_t &ptr);
+
+    /**
+     * Send a frame that has been copied to the space from txReserve(),
+     * or queue it if another frame is being sent
+     * @param len the length of the frame
+     */
+    void txCommit(uint16_t len);
+
+    /**
+     * Check the Ethernet header of a received frame against the frame filter
+     * @param header the first 14 bytes of the frame
+     * @return true if the frame should be passed to the application
+     */
+    boolean acceptFrame(const uint8_t *header);
+
+    /**
+     * Find the multicast hash bin for an address
+     * @param address the 6-byte MAC address
+     * @return the top 6 bits of the Ethernet CRC-32 of the address
+     */
+    static uint8_t multicastHash(const uint8_t *address);
 
     /**
      * Get @ref Sn_TX_FSR register
-     * @return uint16_t. Value of @ref Sn_TX_FSR.
+     * @return uint16_t. Value of @ref Sn_TX_FSR, or 0 if it didn't read
+     *         the same twice in a row within RegisterReadTries
      */
     uint16_t getSn_TX_FSR();
 
+    /**
+     * Read a 16-bit counter that the chip may be changing, such as @ref Sn_RX_RSR
+     * @param address the address of the counter
+     * @return the value once it reads the same twice in a row,
+     *         or 0 if it didn't within RegisterReadTries
+     */
+    uint16_t readCounter(uint16_t address);
+
+    /**
+     * Read a 16-bit counter register that the chip may be changing
+     * @tparam Reg the register, from WiznetRegisters
+     * @return the value once it reads the same twice in a row,
+     *         or 0 if it didn't within RegisterReadTries
+     */
+    template <class Reg>
+    inline uint16_t readCounter() {
+        static_assert(Reg::readable && Reg::width == 2, "Register isn't a 16-bit counter");
+        return readCounter(Reg::address);
+    }
+
     /**
      * Get @ref Sn_RX_RSR register
-     * @return uint16_t. Value of @ref Sn_RX_RSR.
+     * @return uint16_t. Value of @ref Sn_RX_RSR, or 0 if it didn't read
+     *         the same twice in a row within RegisterReadTries
      */
     uint16_t getSn_RX_RSR();
 
 
     /** Common registers */
-    enum {
-        MR = 0x0000,        ///< Mode Register address (R/W)
-        GAR = 0x0001,       ///< Gateway IP Register address (R/W)
-        SUBR = 0x0005,      ///< Subnet mask Register address (R/W)
-        SHAR = 0x0009,      ///< Source MAC Register address (R/W)
-        SIPR = 0x000F,      ///< Source IP Register address (R/W)
-        IR = 0x0015,        ///< Interrupt Register (R/W)
-        IMR = 0x0016,       ///< Socket Interrupt Mask Register (R/W)
-        RTR = 0x0017,       ///< Timeout register address (1 is 100us) (R/W)
-        RCR = 0x0019,       ///< Retry count register (R/W)
-        RMSR = 0x001A,      ///< Receive Memory Size
-        TMSR = 0x001B,      ///< Transmit Memory Size
-    };
+    typedef WiznetRegisters::MR MR;         ///< Mode Register (R/W)
+    typedef WiznetRegisters::GAR GAR;       ///< Gateway IP Register (R/W)
+    typedef WiznetRegisters::SUBR SUBR;     ///< Subnet mask Register (R/W)
+    typedef WiznetRegisters::SHAR SHAR;     ///< Source MAC Register (R/W)
+    typedef WiznetRegisters::SIPR SIPR;     ///< Source IP Register (R/W)
+    typedef WiznetRegisters::IR IR;         ///< Interrupt Register (R/W)
+    typedef WiznetRegisters::IMR IMR;       ///< Socket Interrupt Mask Register (R/W)
+    typedef WiznetRegisters::RTR RTR;       ///< Timeout register (1 is 100us) (R/W)
+    typedef WiznetRegisters::RCR RCR;       ///< Retry count register (R/W)
+    typedef WiznetRegisters::RMSR RMSR;     ///< Receive Memory Size (R/W)
+    typedef WiznetRegisters::TMSR TMSR;     ///< Transmit Memory Size (R/W)
 
-    /** Socket registers */
+    /** Interrupt Mask Register values */
     enum {
-        Sn_MR = 0x0400,     ///< Socket Mode register(R/W)
-        Sn_CR = 0x0401,     ///< Socket command register (R/W)
-        Sn_IR = 0x0402,     ///< Socket interrupt register (R)
-        Sn_SR = 0x0403,     ///< Socket status register (R)
-        Sn_PORT = 0x0404,   ///< Source port register (R/W)
-        Sn_DHAR = 0x0406,   ///< Peer MAC register address (R/W)
-        Sn_DIPR = 0x040C,   ///< Peer IP register address (R/W)
-        Sn_DPORT = 0x0410,  ///< Peer port register address (R/W)
-        Sn_MSSR = 0x0412,   ///< Maximum Segment Size(Sn_MSSR0) register address (R/W)
-        Sn_PROTO = 0x0414,  ///< IP Protocol(PROTO) Register (R/W)
-        Sn_TOS = 0x0415,    ///< IP Type of Service(TOS) Register (R/W)
-        Sn_TTL = 0x0416,    ///< IP Time to live(TTL) Register (R/W)
-        Sn_TX_FSR = 0x0420, ///< Transmit free memory size register (R)
-        Sn_TX_RD = 0x0422,  ///< Transmit memory read pointer register address (R)
-        Sn_TX_WR = 0x0424,  ///< Transmit memory write pointer register address (R/W)
-        Sn_RX_RSR = 0x0426, ///< Received data size register (R)
-        Sn_RX_RD = 0x0428,  ///< Read point of Receive memory (R/W)
-        Sn_RX_WR = 0x042A,  ///< Write point of Receive memory (R)
+        IMR_CONFLICT = 0x80, ///< IP Conflict
+        IMR_UNREACH = 0x40,  ///< Destination unreachable
+        IMR_PPPoE = 0x20,    ///< PPPoE Close
+        IMR_S0_INT = 0x01,   ///< Occurrence of Socket 0 Socket Interrupt
     };
 
-    /** Mode register values */
-    enum {
-        MR_RST = 0x80,    ///< Reset
-        MR_PB = 0x10,     ///< Ping block
-        MR_AI = 0x02,     ///< Address Auto-Increment in Indirect Bus Interface
-        MR_IND = 0x01,    ///< Indirect Bus Interface mode
-    };
+    /** Socket registers, for socket 0 */
+    typedef WiznetRegisters::Socket<0> Socket0;
+    typedef Socket0::MR Sn_MR;          ///< Socket Mode register (R/W)
+    typedef Socket0::CR Sn_CR;          ///< Socket command register (R/W)
+    typedef Socket0::IR Sn_IR;          ///< Socket interrupt register (R/W)
+    typedef Socket0::SR Sn_SR;          ///< Socket status register (R)
+    typedef Socket0::PORT Sn_PORT;      ///< Source port register (R/W)
+    typedef Socket0::DHAR Sn_DHAR;      ///< Peer MAC register (R/W)
+    typedef Socket0::DIPR Sn_DIPR;      ///< Peer IP register (R/W)
+    typedef Socket0::DPORT Sn_DPORT;    ///< Peer port register (R/W)
+    typedef Socket0::MSSR Sn_MSSR;      ///< Maximum Segment Size register (R/W)
+    typedef Socket0::PROTO Sn_PROTO;    ///< IP Protocol(PROTO) Register (R/W)
+    typedef Socket0::TOS Sn_TOS;        ///< IP Type of Service(TOS) Register (R/W)
+    typedef Socket0::TTL Sn_TTL;        ///< IP Time to live(TTL) Register (R/W)
+    typedef Socket0::TX_FSR Sn_TX_FSR;  ///< Transmit free memory size register (R)
+    typedef Socket0::TX_RD Sn_TX_RD;    ///< Transmit memory read pointer register (R)
+    typedef Socket0::TX_WR Sn_TX_WR;    ///< Transmit memory write pointer register (R/W)
+    typedef Socket0::RX_RSR Sn_RX_RSR;  ///< Received data size register (R)
+    typedef Socket0::RX_RD Sn_RX_RD;    ///< Read pointer of Receive memory (R/W)
+    typedef Socket0::RX_WR Sn_RX_WR;    ///< Write pointer of Receive memory (R)
 
-    /** Socket Mode Register values @ref Sn_MR */
-    enum {
-        Sn_MR_CLOSE = 0x00,  ///< Unused socket
-        Sn_MR_TCP = 0x01,    ///< TCP
-        Sn_MR_UDP = 0x02,    ///< UDP
-        Sn_MR_IPRAW = 0x03,  ///< IP LAYER RAW SOCK
-        Sn_MR_MACRAW = 0x04, ///< MAC LAYER RAW SOCK
-        Sn_MR_ND = 0x20,     ///< No Delayed Ack(TCP) flag
-        Sn_MR_MF = 0x40,     ///< Use MAC filter
-        Sn_MR_MULTI = 0x80,  ///< support multicating
-    };
+    /**
+     * Read a 1 or 2 byte register
+     * @tparam Reg the register, from WiznetRegisters
+     * @return The value of the register
+     */
+    template <class Reg>
+    inline typename WiznetRegisters::Value<Reg::width>::type getReg() {
+        static_assert(Reg::readable, "Register can't be read");
+        return Reg::width == 1 ? wizchip_read(Reg::address) : wizchip_read_word(Reg::address);
+    }
 
-    /** Socket Command Register values */
-    enum {
-        Sn_CR_OPEN = 0x01,      ///< Initialise or open socket
-        Sn_CR_CLOSE = 0x10,     ///< Close socket
-        Sn_CR_SEND = 0x20,      ///< Update TX buffer pointer and send data
-        Sn_CR_SEND_MAC = 0x21,  ///< Send data with MAC address, so without ARP process
-        Sn_CR_SEND_KEEP = 0x22, ///< Send keep alive message
-        Sn_CR_RECV = 0x40,      ///< Update RX buffer pointer and receive data
-    };
+    /**
+     * Write a 1 or 2 byte register
+     * @tparam Reg the register, from WiznetRegisters
+     * @param value The value to write
+     */
+    template <class Reg>
+    inline void setReg(typename WiznetRegisters::Value<Reg::width>::type value) {
+        static_assert(Reg::writable, "Register is read-only");
+        if (Reg::width == 1)
+            wizchip_write(Reg::address, value);
+        else
+            wizchip_write_word(Reg::address, value);
+    }
 
-    /** Socket Interrupt register values */
-    enum {
-        Sn_IR_CON = 0x01,      ///< CON Interrupt
-        Sn_IR_DISCON = 0x02,   ///< DISCON Interrupt
-        Sn_IR_RECV = 0x04,     ///< RECV Interrupt
-        Sn_IR_TIMEOUT = 0x08,  ///< TIMEOUT Interrupt
-        Sn_IR_SENDOK = 0x10,   ///< SEND_OK Interrupt
-    };
+    /**
+     * Read a register that is longer than 2 bytes, such as an address
+     * @tparam Reg the register, from WiznetRegisters
+     * @param buf Pointer to a buffer of Reg::width bytes
+     */
+    template <class Reg>
+    inline void getRegBuf(uint8_t *buf) {
+        static_assert(Reg::readable, "Register can't be read");
+        wizchip_read_buf(Reg::address, buf, Reg::width);
+    }
 
-    /** Socket Status Register values */
-    enum {
-        SOCK_CLOSED = 0x00,      ///< Closed
-        SOCK_INIT = 0x13,        ///< Initiate state
-        SOCK_LISTEN = 0x14,      ///< Listen state
-        SOCK_SYNSENT = 0x15,     ///< Connection state
-        SOCK_SYNRECV = 0x16,     ///< Connection state
-        SOCK_ESTABLISHED = 0x17, ///< Success to connect
-        SOCK_FIN_WAIT = 0x18,    ///< Closing state
-        SOCK_CLOSING = 0x1A,     ///< Closing state
-        SOCK_TIME_WAIT = 0x1B,   ///< Closing state
-        SOCK_CLOSE_WAIT = 0x1C,  ///< Closing state
-        SOCK_LAST_ACK = 0x1D,    ///< Closing state
-        SOCK_UDP = 0x22,         ///< UDP socket
-        SOCK_IPRAW = 0x32,       ///< IP raw mode socket
-        SOCK_MACRAW = 0x42,      ///< MAC raw mode socket
-    };
+    /**
+     * Write a register that is longer than 2 bytes, such as an address
+     * @tparam Reg the register, from WiznetRegisters
+     * @param buf Pointer to Reg::width bytes to write
+     */
+    template <class Reg>
+    inline void setRegBuf(const uint8_t *buf) {
+        static_assert(Reg::writable, "Register is read-only");
+        wizchip_write_buf(Reg::address, buf, Reg::width);
+    }
 
     /**
      * Set Mode Register
@@ -314,7 +1379,7 @@ private:
      * @sa getMR()
      */
     inline void setMR(uint8_t mode) {
-        wizchip_write(MR, mode);
+        setReg<MR>(mode);
     }
 
     /**
@@ -323,7 +1388,7 @@ private:
      * @sa setMR()
      */
     inline uint8_t getMR() {
-        return wizchip_read(MR);
+        return getReg<MR>();
     }
 
     /**
@@ -332,7 +1397,7 @@ private:
      * @sa getSHAR()
      */
     inline void setSHAR(const uint8_t* macaddr) {
-        wizchip_write_buf(SHAR, macaddr, 6);
+        setRegBuf<SHAR>(macaddr);
     }
 
     /**
@@ -341,7 +1406,7 @@ private:
      * @sa setSHAR()
      */
     inline void getSHAR(uint8_t* macaddr) {
-        wizchip_read_buf(SHAR, macaddr, 6);
+        getRegBuf<SHAR>(macaddr);
     }
 
     /**
@@ -350,7 +1415,7 @@ private:
      * @sa GetSn_TX_WR()
      */
     inline uint16_t getSn_TX_WR() {
-        return wizchip_read_word(Sn_TX_WR);
+        return getReg<Sn_TX_WR>();
     }
 
     /**
@@ -359,7 +1424,7 @@ private:
      * @sa GetSn_TX_WR()
      */
     inline void setSn_TX_WR(uint16_t txwr) {
-        wizchip_write_word(Sn_TX_WR, txwr);
+        setReg<Sn_TX_WR>(txwr);
     }
 
     /**
@@ -368,7 +1433,7 @@ private:
      * @sa setSn_RX_RD()
      */
     inline uint16_t getSn_RX_RD() {
-        return wizchip_read_word(Sn_RX_RD);
+        return getReg<Sn_RX_RD>();
     }
 
     /**
@@ -377,7 +1442,7 @@ private:
      * @sa getSn_RX_RD()
      */
     inline void setSn_RX_RD(uint16_t rxrd) {
-        wizchip_write_word(Sn_RX_RD, rxrd);
+        setReg<Sn_RX_RD>(rxrd);
     }
 
     /**
@@ -386,7 +1451,7 @@ private:
      * @sa getSn_MR()
      */
     inline void setSn_MR(uint8_t mr) {
-        wizchip_write(Sn_MR, mr);
+        setReg<Sn_MR>(mr);
     }
 
     /**
@@ -395,15 +1460,24 @@ private:
      * @sa setSn_MR()
      */
     inline uint8_t getSn_MR() {
-        return wizchip_read(Sn_MR);
+        return getReg<Sn_MR>();
     }
 
     /**
      * Set @ref Sn_CR register, then wait for the command to execute
      * @param (uint8_t)cr Value to set @ref Sn_CR
+     * @return true, or false if the chip didn't complete it within WiznetBus::CommandTimeoutMicros
      * @sa getSn_CR()
      */
-    void setSn_CR(uint8_t cr);
+    boolean setSn_CR(uint8_t cr);
+
+    /**
+     * Give a command to any socket, then wait for it to execute
+     * @param sn the socket number
+     * @param cr the command
+     * @return true, or false if the chip didn't complete it within WiznetBus::CommandTimeoutMicros
+     */
+    boolean socketCommand(uint8_t sn, uint8_t cr);
 
     /**
      * Get @ref Sn_CR register
@@ -411,7 +1485,7 @@ private:
      * @sa setSn_CR()
      */
     inline uint8_t getSn_CR() {
-        return wizchip_read(Sn_CR);
+        return getReg<Sn_CR>();
     }
 
     /**
@@ -419,7 +1493,7 @@ private:
      * @return uint8_t. Value of @ref Sn_SR.
      */
     inline uint8_t getSn_SR() {
-        return wizchip_read(Sn_SR);
+        return getReg<Sn_SR>();
     }
 
     /**
@@ -428,7 +1502,7 @@ private:
      * @sa setSn_IR()
      */
     inline uint8_t getSn_IR() {
-        return wizchip_read(Sn_IR);
+        return getReg<Sn_IR>();
     }
 
     /**
@@ -437,7 +1511,7 @@ private:
      * @sa getSn_IR()
      */
     inline void setSn_IR(uint8_t ir) {
-        wizchip_write(Sn_IR, ir);
+        setReg<Sn_IR>(ir);
     }
 };
 
@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_bus.h"
+#include "w5100_regs.h"
+
+#include <SPI.h>
+
+#if W5100_STATS
+#define W5100_COUNT_TRANSACTION() (_transactions++)
+#else
+#define W5100_COUNT_TRANSACTION() do {} while (0)
+#endif
+
+#if W5100_SPI_INTERRUPT && defined(__AVR__)
+#define W5100_SPI_ISR 1
+#else
+#define W5100_SPI_ISR 0
+#endif
+
+#if defined(__AVR__)
+/*
+ * Transfer a byte by using the SPI registers directly, so that it is inlined.
+ * Nothing else is done while the byte is being shifted out.
+ */
+static inline uint8_t spiTransfer(uint8_t data)
+{
+    SPDR = data;
+    while (!(SPSR & _BV(SPIF)));
+    return SPDR;
+}
+
+/*
+ * Receive a block of bytes. The next byte is started as soon as the previous
+ * one has finished, and the previous one is then read from the receive buffer,
+ * which is double buffered, while the next byte is being shifted in.
+ */
+static inline void spiReceive(uint8_t *pBuf, uint16_t len)
+{
+    if (len == 0)
+        return;
+
+    SPDR = 0;
+    for (uint16_t i = 0; i < len - 1; i++) {
+        while (!(SPSR & _BV(SPIF)));
+        SPDR = 0;
+        pBuf[i] = SPDR;
+    }
+    while (!(SPSR & _BV(SPIF)));
+    pBuf[len - 1] = SPDR;
+}
+
+/*
+ * Send a block of bytes, loading each byte as soon as the previous one has gone
+ */
+static inline void spiSend(const uint8_t *pBuf, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        SPDR = pBuf[i];
+        while (!(SPSR & _BV(SPIF)));
+    }
+}
+#else
+static inline uint8_t spiTransfer(uint8_t data)
+{
+    return SPI.transfer(data);
+}
+
+static inline void spiReceive(uint8_t *pBuf, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        pBuf[i] = SPI.transfer(0);
+    }
+}
+
+static inline void spiSend(const uint8_t *pBuf, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        SPI.transfer(pBuf[i]);
+    }
+}
+#endif
+
+
+void WiznetChipSelect::begin()
+{
+    pinMode(_pin, OUTPUT);
+#if defined(__AVR__)
+    _port = portOutputRegister(digitalPinToPort(_pin));
+    _mask = digitalPinToBitMask(_pin);
+#endif
+    deselect();
+}
+
+
+WiznetSpiBus::WiznetSpiBus(int8_t cs, uint32_t clock)
+    : _cs(cs)
+{
+    setClock(clock);
+}
+
+void WiznetSpiBus::setClock(uint32_t clock)
+{
+    if (clock > MaxClock)
+        clock = MaxClock;
+
+    _clock = clock;
+    _settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
+}
+
+void WiznetSpiBus::begin()
+{
+    _cs.begin();
+    SPI.begin();
+}
+
+inline uint8_t WiznetSpiBus::readByte(uint16_t address)
+{
+    uint8_t ret;
+
+    W5100_COUNT_TRANSACTION();
+    _cs.select();
+    spiTransfer(0x0F);
+    spiTransfer((address & 0xFF00) >>  8);
+    spiTransfer((address & 0x00FF) >>  0);
+    ret = spiTransfer(0);
+    _cs.deselect();
+
+    return ret;
+}
+
+inline void WiznetSpiBus::writeByte(uint16_t address, uint8_t wb)
+{
+    W5100_COUNT_TRANSACTION();
+    _cs.select();
+    spiTransfer(0xF0);
+    spiTransfer((address & 0xFF00) >>  8);
+    spiTransfer((address & 0x00FF) >>  0);
+    spiTransfer(wb);    // Data write (write 1byte data)
+    _cs.deselect();
+}
+
+uint8_t WiznetSpiBus::read(uint16_t address)
+{
+    uint8_t ret;
+
+    SPI.beginTransaction(_settings);
+    ret = readByte(address);
+    SPI.endTransaction();
+
+    return ret;
+}
+
+void WiznetSpiBus::write(uint16_t address, uint8_t wb)
+{
+    SPI.beginTransaction(_settings);
+    writeByte(address, wb);
+    SPI.endTransaction();
+}
+
+void WiznetSpiBus::readBuf(uint16_t address, uint8_t* pBuf, uint16_t len)
+{
+    // One SPI transaction for the whole buffer, but the W5100
+    // still needs a frame and a chip select for every byte
+    SPI.beginTransaction(_settings);
+    for(uint16_t i = 0; i < len; i++)
+    {
+        pBuf[i] = readByte(address + i);
+    }
+    SPI.endTransaction();
+}
+
+void WiznetSpiBus::writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len)
+{
+    SPI.beginTransaction(_settings);
+    for(uint16_t i = 0; i < len; i++)
+    {
+        writeByte(address + i, pBuf[i]);
+    }
+    SPI.endTransaction();
+}
+
+
+#if W5100_SPI_ISR
+static WiznetSpiInterruptBus *spiInterruptBus = NULL;  /* The bus with a transfer in progress */
+
+ISR(SPI_STC_vect)
+{
+    if (spiInterruptBus)
+        spiInterruptBus->handleInterrupt();
+}
+#endif
+
+WiznetSpiInterruptBus::WiznetSpiInterruptBus(int8_t cs, uint32_t clock)
+    : WiznetSpiBus(cs, clock)
+{
+    _busy = false;
+}
+
+void WiznetSpiInterruptBus::finish()
+{
+    while (_busy) {
+#if !W5100_SPI_ISR
+        handleInterrupt();
+#endif
+    }
+}
+
+uint8_t WiznetSpiInterruptBus::read(uint16_t address)
+{
+    finish();
+    return WiznetSpiBus::read(address);
+}
+
+void WiznetSpiInterruptBus::write(uint16_t address, uint8_t wb)
+{
+    finish();
+    WiznetSpiBus::write(address, wb);
+}
+
+void WiznetSpiInterruptBus::readBuf(uint16_t address, uint8_t* pBuf, uint16_t len)
+{
+    finish();
+    WiznetSpiBus::readBuf(address, pBuf, len);
+}
+
+void WiznetSpiInterruptBus::writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len)
+{
+    finish();
+    WiznetSpiBus::writeBuf(address, pBuf, len);
+}
+
+void WiznetSpiInterruptBus::submitRead(uint16_t address, uint8_t* pBuf, uint16_t len, Completion done, void *context)
+{
+    submit(address, pBuf, NULL, len, done, context);
+}
+
+void WiznetSpiInterruptBus::submitWrite(uint16_t address, const uint8_t* pBuf, uint16_t len, Completion done, void *context)
+{
+    submit(address, NULL, pBuf, len, done, context);
+}
+
+void WiznetSpiInterruptBus::submit(uint16_t address, uint8_t *rx_buf, const uint8_t *tx_buf, uint16_t len,
+                                   Completion done, void *context)
+{
+    finish();
+    if (len == 0) {
+        done(context);
+        return;
+    }
+
+    _writing = (tx_buf != NULL);
+    _address = address;
+    _rx_buf = rx_buf;
+    _tx_buf = tx_buf;
+    _len = len;
+    _pos = 0;
+    _phase = 0;
+    _done = done;
+    _context = context;
+    _busy = true;
+
+    SPI.beginTransaction(_settings);
+    W5100_COUNT_TRANSACTION();
+    _cs.select();
+#if W5100_SPI_ISR
+    spiInterruptBus = this;
+    SPCR |= _BV(SPIE);
+#endif
+    startByte(frameByte());
+}
+
+uint8_t WiznetSpiInterruptBus::frameByte() const
+{
+    uint16_t address = _address + _pos;
+
+    switch (_phase) {
+    case 0:  return _writing ? 0xF0 : 0x0F;
+    case 1:  return (address & 0xFF00) >> 8;
+    case 2:  return (address & 0x00FF) >> 0;
+    default: return _writing ? _tx_buf[_pos] : 0;
+    }
+}
+
+inline void WiznetSpiInterruptBus::startByte(uint8_t data)
+{
+#if W5100_SPI_ISR
+    SPDR = data;
+#else
+    // Without the interrupt the byte is moved now, and handled by the next step
+    _received = spiTransfer(data);
+#endif
+}
+
+void WiznetSpiInterruptBus::handleInterrupt()
+{
+    uint8_t received;
+
+    if (!_busy)
+        return;
+
+#if W5100_SPI_ISR
+    received = SPDR;
+#else
+    received = _received;
+#endif
+
+    if (_phase < 3) {
+        _phase++;
+        startByte(frameByte());
+        return;
+    }
+
+    // The last byte of the frame, which is the data
+    if (!_writing)
+        _rx_buf[_pos] = received;
+    _cs.deselect();
+
+    if (++_pos < _len) {
+        _phase = 0;
+        W5100_COUNT_TRANSACTION();
+        _cs.select();
+        startByte(frameByte());
+        return;
+    }
+
+#if W5100_SPI_ISR
+    SPCR &= ~_BV(SPIE);
+    spiInterruptBus = NULL;
+#endif
+    SPI.endTransaction();
+    _busy = false;
+    _done(_context);
+}
+
+void WiznetSpiInterruptBus::service()
+{
+#if !W5100_SPI_ISR
+    for (uint8_t i = 0; i < ServiceBytes && _busy; i++) {
+        handleInterrupt();
+    }
+#endif
+}
+
+void WiznetSpiInterruptBus::cancel()
+{
+    if (!_busy)
+        return;
+
+#if W5100_SPI_ISR
+    // Stop the interrupt first, so that it can't move the transfer on
+    SPCR &= ~_BV(SPIE);
+    spiInterruptBus = NULL;
+#endif
+    // The chip ignores an SPI frame that was cut short by chip select
+    _cs.deselect();
+    SPI.endTransaction();
+    _busy = false;
+}
+
+
+WiznetW5500Bus::WiznetW5500Bus(int8_t cs, uint32_t clock)
+    : _cs(cs)
+{
+    setClock(clock);
+    _rmsr = 0x55;
+    _tmsr = 0x55;
+}
+
+void WiznetW5500Bus::setClock(uint32_t clock)
+{
+    if (clock > MaxClock)
+        clock = MaxClock;
+
+    _clock = clock;
+    _settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
+}
+
+void WiznetW5500Bus::begin()
+{
+    _cs.begin();
+    SPI.begin();
+}
+
+void WiznetW5500Bus::burstStart(uint8_t block, uint16_t address, uint8_t control)
+{
+    W5100_COUNT_TRANSACTION();
+    SPI.beginTransaction(_settings);
+    _cs.select();
+    spiTransfer((address & 0xFF00) >>  8);
+    spiTransfer((address & 0x00FF) >>  0);
+    spiTransfer((block << 3) | control | W5500Registers::ControlVariable);
+}
+
+void WiznetW5500Bus::burstRead(uint8_t block, uint16_t address, uint8_t* pBuf, uint16_t len)
+{
+    burstStart(block, address, 0);
+    spiReceive(pBuf, len);
+    _cs.deselect();
+    SPI.endTransaction();
+}
+
+void WiznetW5500Bus::burstWrite(uint8_t block, uint16_t address, const uint8_t* pBuf, uint16_t len)
+{
+    burstStart(block, address, W5500Registers::ControlWrite);
+    spiSend(pBuf, len);
+    _cs.deselect();
+    SPI.endTransaction();
+}
+
+uint8_t WiznetW5500Bus::findBuffer(uint8_t msr, uint16_t &offset)
+{
+    uint8_t sn = 0;
+
+    // The memory is shared out in socket order, as on the W5100
+    while (sn < WiznetRegisters::SocketCount - 1 &&
+           offset >= WiznetRegisters::bufferOffset(msr, sn + 1)) {
+        sn++;
+    }
+
+    offset -= WiznetRegisters::bufferOffset(msr, sn);
+    return sn;
+}
+
+uint8_t WiznetW5500Bus::translate(uint16_t &address)
+{
+    if (address >= WiznetRegisters::RxMemoryAddress) {
+        address -= WiznetRegisters::RxMemoryAddress;
+        return W5500Registers::rxBlock(findBuffer(_rmsr, address));
+    } else if (address >= WiznetRegisters::TxMemoryAddress) {
+        address -= WiznetRegisters::TxMemoryAddress;
+        return W5500Registers::txBlock(findBuffer(_tmsr, address));
+    } else if (address >= WiznetRegisters::SocketBase) {
+        // The socket register offsets are the same on both chips
+        uint8_t sn = (address - WiznetRegisters::SocketBase) / WiznetRegisters::SocketStride;
+        address = (address - WiznetRegisters::SocketBase) % WiznetRegisters::SocketStride;
+        return W5500Registers::socketBlock(sn);
+    } else {
+        // RTR and RCR have moved up, the addresses and MR are unchanged
+        if (address >= WiznetRegisters::RTR::address)
+            address += W5500Registers::RTR - WiznetRegisters::RTR::address;
+        return W5500Registers::commonBlock();
+    }
+}
+
+void WiznetW5500Bus::setBufferSizes(uint8_t sizeRegister, uint8_t msr)
+{
+    for (uint8_t sn = 0; sn < W5500Registers::SocketCount; sn++) {
+        uint8_t kb = 0;
+
+        // Sockets that the memory doesn't reach get none, as on the W5100
+        if (sn < WiznetRegisters::SocketCount && WiznetRegisters::bufferFits(msr, sn))
+            kb = WiznetRegisters::bufferLength(msr, sn) >> 10;
+
+        burstWrite(W5500Registers::socketBlock(sn), sizeRegister, &kb, 1);
+    }
+}
+
+uint8_t WiznetW5500Bus::read(uint16_t address)
+{
+    uint8_t value, sockets;
+    uint8_t block;
+
+    switch (address) {
+    case WiznetRegisters::IR::address:
+        // The socket interrupts have their own register on the W5500
+        burstRead(W5500Registers::commonBlock(), W5500Registers::IR, &value, 1);
+        burstRead(W5500Registers::commonBlock(), W5500Registers::SIR, &sockets, 1);
+        return (value & 0xE0) | (sockets & 0x0F);
+    case WiznetRegisters::IMR::address:
+        burstRead(W5500Registers::commonBlock(), W5500Registers::IMR, &value, 1);
+        burstRead(W5500Registers::commonBlock(), W5500Registers::SIMR, &sockets, 1);
+        return (value & 0xE0) | (sockets & 0x0F);
+    case WiznetRegisters::RMSR::address:
+        return _rmsr;
+    case WiznetRegisters::TMSR::address:
+        return _tmsr;
+    }
+
+    block = translate(address);
+    burstRead(block, address, &value, 1);
+
+    if ((block & 0x03) == 0x01 && address == 0x00 &&
+        (value & 0x0F) == WiznetRegisters::Sn_MR_MACRAW && (value & W5500Registers::Sn_MR_MFEN)) {
+        value = (value & 0x0F) | WiznetRegisters::Sn_MR_MF;
+    }
+
+    return value;
+}
+
+void WiznetW5500Bus::write(uint16_t address, uint8_t wb)
+{
+    uint8_t value;
+    uint8_t block;
+
+    switch (address) {
+    case WiznetRegisters::MR::address:
+        value = wb & W5500Registers::MR_MASK;
+        burstWrite(W5500Registers::commonBlock(), W5500Registers::MR, &value, 1);
+        if (wb & WiznetRegisters::MR_RST) {
+            // Back to 2kB buffers for each socket
+            _rmsr = 0x55;
+            _tmsr = 0x55;
+        }
+        return;
+    case WiznetRegisters::IR::address:
+        // Socket interrupts are cleared in Sn_IR, as on the W5100
+        value = wb & 0xE0;
+        burstWrite(W5500Registers::commonBlock(), W5500Registers::IR, &value, 1);
+        return;
+    case WiznetRegisters::IMR::address:
+        value = wb & 0xE0;
+        burstWrite(W5500Registers::commonBlock(), W5500Registers::IMR, &value, 1);
+        value = wb & 0x0F;
+        burstWrite(W5500Registers::commonBlock(), W5500Registers::SIMR, &value, 1);
+        return;
+    case WiznetRegisters::RMSR::address:
+        _rmsr = wb;
+        setBufferSizes(W5500Registers::Sn_RXBUF_SIZE, wb);
+        return;
+    case WiznetRegisters::TMSR::address:
+        _tmsr = wb;
+        setBufferSizes(W5500Registers::Sn_TXBUF_SIZE, wb);
+        return;
+    }
+
+    block = translate(address);
+
+    if ((block & 0x03) == 0x01 && address == 0x00 &&
+        (wb & 0x0F) == WiznetRegisters::Sn_MR_MACRAW && (wb & WiznetRegisters::Sn_MR_MF)) {
+        // The MAC filter bit has moved
+        wb = (wb & 0x0F) | W5500Registers::Sn_MR_MFEN;
+    }
+
+    burstWrite(block, address, &wb, 1);
+}
+
+void WiznetW5500Bus::readBuf(uint16_t address, uint8_t* pBuf, uint16_t len)
+{
+    // Buffers never include the registers that are translated individually
+    uint8_t block = translate(address);
+    burstRead(block, address, pBuf, len);
+}
+
+void WiznetW5500Bus::writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len)
+{
+    uint8_t block = translate(address);
+    burstWrite(block, address, pBuf, len);
+}
+
+
+// The chip takes up to 80ns from /RD going low to drive valid data
+static const uint16_t ReadAccessNanos = 80;
+
+// It latches the data as /WR goes high, so /WR is held low for long enough
+// to cover the pulse width and the data setup time, and the data is then
+// held for a little longer before anything changes it
+static const uint16_t WritePulseNanos = 70;
+static const uint16_t WriteHoldNanos = 10;
+
+#if defined(F_CPU)
+// Whole CPU cycles to cover them. Reading takes one more for the input
+// synchroniser, which delays what the port register shows by a cycle.
+static const uint8_t ReadAccessCycles = ((F_CPU / 1000000UL) * ReadAccessNanos + 999) / 1000 + 1;
+static const uint8_t WritePulseCycles = ((F_CPU / 1000000UL) * WritePulseNanos + 999) / 1000;
+static const uint8_t WriteHoldCycles = ((F_CPU / 1000000UL) * WriteHoldNanos + 999) / 1000;
+
+static inline void cycleDelay(uint8_t cycles)
+{
+    for (uint8_t i = 0; i < cycles; i++) {
+        __asm__ __volatile__ ("nop");
+    }
+}
+#endif
+
+static inline void readAccessDelay()
+{
+#if defined(F_CPU)
+    cycleDelay(ReadAccessCycles);
+#else
+    delayMicroseconds(1);
+#endif
+}
+
+static inline void writePulseDelay()
+{
+#if defined(F_CPU)
+    cycleDelay(WritePulseCycles);
+#else
+    delayMicroseconds(1);
+#endif
+}
+
+static inline void writeHoldDelay()
+{
+#if defined(F_CPU)
+    cycleDelay(WriteHoldCycles);
+#else
+    delayMicroseconds(1);
+#endif
+}
+
+WiznetParallelBus::WiznetParallelBus(const uint8_t data[8], uint8_t addr0, uint8_t addr1,
+                                     uint8_t cs, uint8_t rd, uint8_t wr)
+{
+    for (uint8_t i = 0; i < 8; i++) {
+        _data[i].number = data[i];
+    }
+    _addr0.number = addr0;
+    _addr1.number = addr1;
+    _cs.number = cs;
+    _rd.number = rd;
+    _wr.number = wr;
+    _whole_port = false;
+    _data_output = false;
+}
+
+void WiznetParallelBus::resolve(Pin &pin, uint8_t number)
+{
+    uint8_t port = digitalPinToPort(number);
+
+    pin.number = number;
+    pin.out = portOutputRegister(port);
+    pin.in = portInputRegister(port);
+    pin.mode = portModeRegister(port);
+    pin.mask = digitalPinToBitMask(number);
+}
+
+void WiznetParallelBus::begin()
+{
+    resolve(_addr0, _addr0.number);
+    resolve(_addr1, _addr1.number);
+    resolve(_cs, _cs.number);
+    resolve(_rd, _rd.number);
+    resolve(_wr, _wr.number);
+
+    // Control pins are active low
+    digitalWrite(_cs.number, HIGH);
+    digitalWrite(_rd.number, HIGH);
+    digitalWrite(_wr.number, HIGH);
+    pinMode(_cs.number, OUTPUT);
+    pinMode(_rd.number, OUTPUT);
+    pinMode(_wr.number, OUTPUT);
+    pinMode(_addr0.number, OUTPUT);
+    pinMode(_addr1.number, OUTPUT);
+
+#if defined(__AVR__)
+    _whole_port = true;
+#endif
+    for (uint8_t i = 0; i < 8; i++) {
+        resolve(_data[i], _data[i].number);
+        if (_data[i].out != _data[0].out || _data[i].mask != (PortMask)(1 << i)) {
+            _whole_port = false;
+        }
+        pinMode(_data[i].number, INPUT);
+    }
+    _data_output = false;
+
+    // Switch the chip to indirect mode with auto-increment
+    writeMode(0);
+}
+
+void WiznetParallelBus::setDataDirection(boolean output)
+{
+    if (output == _data_output)
+        return;
+
+    if (_whole_port) {
+        *_data[0].mode = output ? 0xFF : 0x00;
+    } else {
+        for (uint8_t i = 0; i < 8; i++) {
+            if (output) {
+                *_data[i].mode |= _data[i].mask;
+            } else {
+                *_data[i].mode &= ~_data[i].mask;
+            }
+        }
+    }
+
+    _data_output = output;
+}
+
+void WiznetParallelBus::setAddress(uint8_t reg)
+{
+    if (reg & 0x01) set(_addr0); else clear(_addr0);
+    if (reg & 0x02) set(_addr1); else clear(_addr1);
+}
+
+void WiznetParallelBus::busWrite(uint8_t data)
+{
+    setDataDirection(true);
+
+    if (_whole_port) {
+        *_data[0].out = data;
+    } else {
+        for (uint8_t i = 0; i < 8; i++) {
+            if (data & (1 << i)) set(_data[i]); else clear(_data[i]);
+        }
+    }
+
+    clear(_wr);
+    writePulseDelay();
+    set(_wr);
+    writeHoldDelay();
+}
+
+uint8_t WiznetParallelBus::busRead()
+{
+    uint8_t data = 0;
+
+    setDataDirection(false);
+
+    clear(_rd);
+    readAccessDelay();
+    if (_whole_port) {
+        data = *_data[0].in;
+    } else {
+        for (uint8_t i = 0; i < 8; i++) {
+            if (*_data[i].in & _data[i].mask)
+                data |= (1 << i);
+        }
+    }
+    set(_rd);
+
+    return data;
+}
+
+void WiznetParallelBus::setIndirectAddress(uint16_t address)
+{
+    setAddress(IDM_AR0);
+    busWrite((address & 0xFF00) >> 8);
+    setAddress(IDM_AR1);
+    busWrite((address & 0x00FF) >> 0);
+    setAddress(IDM_DR);
+}
+
+uint8_t WiznetParallelBus::readMode()
+{
+    uint8_t mode;
+
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setAddress(IDM_MR);
+    mode = busRead();
+    set(_cs);
+
+    return mode;
+}
+
+void WiznetParallelBus::writeMode(uint8_t mode)
+{
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setAddress(IDM_MR);
+    busWrite(mode | WiznetRegisters::MR_IND | WiznetRegisters::MR_AI);
+    set(_cs);
+
+    if (mode & WiznetRegisters::MR_RST) {
+        // The reset puts the chip back into direct mode
+        uint32_t start = micros();
+        while (readMode() & WiznetRegisters::MR_RST) {
+            if (WiznetBus::expired(start, CommandTimeoutMicros))
+                return;
+        }
+        writeMode(mode & ~WiznetRegisters::MR_RST);
+    }
+}
+
+uint8_t WiznetParallelBus::read(uint16_t address)
+{
+    uint8_t ret;
+
+    if (address == WiznetRegisters::MR::address)
+        return readMode();
+
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setIndirectAddress(address);
+    ret = busRead();
+    set(_cs);
+
+    return ret;
+}
+
+void WiznetParallelBus::write(uint16_t address, uint8_t data)
+{
+    if (address == WiznetRegisters::MR::address) {
+        writeMode(data);
+        return;
+    }
+
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setIndirectAddress(address);
+    busWrite(data);
+    set(_cs);
+}
+
+void WiznetParallelBus::readBuf(uint16_t address, uint8_t* pBuf, uint16_t len)
+{
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setIndirectAddress(address);
+    for(uint16_t i = 0; i < len; i++)
+    {
+        // The address is incremented by the chip after each access
+        pBuf[i] = busRead();
+    }
+    set(_cs);
+}
+
+void WiznetParallelBus::writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len)
+{
+    W5100_COUNT_TRANSACTION();
+    clear(_cs);
+    setIndirectAddress(address);
+    for(uint16_t i = 0; i < len; i++)
+    {
+        // The address is incremented by the chip after each access
+        busWrite(pBuf[i]);
+    }
+    set(_cs);
+}
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_BUS_H
+#define	W5100_BUS_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "w5100_config.h"
+
+/**
+ * The bus that connects the microcontroller to the WIZnet chip
+ *
+ * The Wiznet5100 register and buffer logic is written against this interface,
+ * so that the chip can be connected in different ways.
+ * Addresses are in the 16-bit address space of the chip.
+ */
+class WiznetBus {
+
+public:
+    virtual ~WiznetBus() {}
+
+    /**
+     * Set up the pins and peripherals used by the bus
+     */
+    virtual void begin() = 0;
+
+    /**
+     * Read a 1 byte value from a register.
+     * @param address Register address
+     * @return The value of register
+     */
+    virtual uint8_t read(uint16_t address) = 0;
+
+    /**
+     * Write a 1 byte value to a register.
+     * @param address Register address
+     * @param data Write data
+     */
+    virtual void write(uint16_t address, uint8_t data) = 0;
+
+    /**
+     * It reads sequence data from registers.
+     * @param address Register address
+     * @param pBuf Pointer buffer to read data
+     * @param len Data length
+     */
+    virtual void readBuf(uint16_t address, uint8_t* pBuf, uint16_t len) = 0;
+
+    /**
+     * It writes sequence data to registers.
+     * @param address Register address
+     * @param pBuf Pointer buffer to write data
+     * @param len Data length
+     */
+    virtual void writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len) = 0;
+
+    /**
+     * Called when a transfer started with submitRead() or submitWrite() has finished
+     * It may be called from an interrupt, or before the submit function returns,
+     * so it should do no more than start the next transfer or set a flag.
+     * @param context the pointer that was passed with the transfer
+     */
+    typedef void (*Completion)(void *context);
+
+    /**
+     * Start reading data from the chip, and carry on without waiting for it
+     *
+     * Buses that can move data in the background, with an interrupt or DMA,
+     * return straight away. The others read the data before returning,
+     * which is what this does unless it is overridden. Only one transfer can be
+     * in progress; read(), write(), readBuf() and writeBuf() wait for it to finish.
+     *
+     * @param address Register address
+     * @param pBuf Pointer buffer to read data, which must not be used until done is called
+     * @param len Data length
+     * @param done the function to call once the data has been read
+     * @param context a pointer to pass to done
+     */
+    virtual void submitRead(uint16_t address, uint8_t* pBuf, uint16_t len, Completion done, void *context)
+    {
+        readBuf(address, pBuf, len);
+        done(context);
+    }
+
+    /**
+     * Start writing data to the chip, and carry on without waiting for it
+     * @param address Register address
+     * @param pBuf Pointer buffer to write data, which must not be changed until done is called
+     * @param len Data length
+     * @param done the function to call once the data has been written
+     * @param context a pointer to pass to done
+     * @sa submitRead()
+     */
+    virtual void submitWrite(uint16_t address, const uint8_t* pBuf, uint16_t len, Completion done, void *context)
+    {
+        writeBuf(address, pBuf, len);
+        done(context);
+    }
+
+    /**
+     * Move a background transfer along, for buses that aren't driven by an interrupt
+     * Wiznet5100::poll() calls this while a transfer is in progress.
+     */
+    virtual void service() {}
+
+    /**
+     * Stop a transfer started with submitRead() or submitWrite() that hasn't finished
+     * Afterwards the bus doesn't touch the transfer's buffer or call its done.
+     * Buses that finish their transfers before submitting returns have nothing to stop.
+     */
+    virtual void cancel() {}
+
+    /**
+     * Change the bus clock, if it has one
+     * @param clock the clock in Hz
+     */
+    virtual void setClock(uint32_t clock) { (void)clock; }
+
+    /**
+     * Get the bus clock
+     * @return the clock in Hz, or 0 if the bus doesn't have a clock
+     */
+    virtual uint32_t clock() const { return 0; }
+
+    static const uint32_t CommandTimeoutMicros = 10000; /* Microseconds to wait for a socket command or reset to complete */
+
+    /**
+     * Check whether the time allowed for an operation has run out
+     * @param start micros() when the operation started
+     * @param timeout the time allowed, in microseconds
+     * @return true if it has run out
+     */
+    static boolean expired(uint32_t start, uint32_t timeout) {
+        return micros() - start >= timeout;
+    }
+
+#if W5100_STATS
+    /**
+     * Get the number of bus transactions (chip select cycles) since the last reset
+     */
+    uint32_t transactions() const { return _transactions; }
+
+    /**
+     * Reset the number of bus transactions to zero
+     */
+    void resetTransactions() { _transactions = 0; }
+
+protected:
+    WiznetBus() : _transactions(0) {}
+
+    uint32_t _transactions;
+#endif
+};
+
+
+/**
+ * Chip select pin for an SPI bus
+ *
+ * On AVR the pin is resolved to its port register and mask once, in begin(),
+ * so selecting the chip is a single register update rather than a digitalWrite().
+ */
+class WiznetChipSelect {
+
+public:
+    /**
+     * @param pin the Arduino pin connected to the chip select
+     */
+    WiznetChipSelect(int8_t pin) : _pin(pin) {}
+
+    /**
+     * Make the pin an output, and deselect the chip
+     */
+    void begin();
+
+    /**
+     * Get the Arduino pin number
+     * @return the pin
+     */
+    int8_t pin() const { return _pin; }
+
+    /**
+     * Select the chip (drive the pin low)
+     */
+    inline void select()
+    {
+#if defined(__AVR__)
+        *_port &= ~_mask;
+#else
+        digitalWrite(_pin, LOW);
+#endif
+    }
+
+    /**
+     * Deselect the chip (drive the pin high)
+     */
+    inline void deselect()
+    {
+#if defined(__AVR__)
+        *_port |= _mask;
+#else
+        digitalWrite(_pin, HIGH);
+#endif
+    }
+
+private:
+    int8_t _pin;
+#if defined(__AVR__)
+    volatile uint8_t *_port;
+    uint8_t _mask;
+#endif
+};
+
+
+/**
+ * SPI bus to a W5100
+ * Every byte is transferred in a separate 4-byte SPI frame.
+ */
+class WiznetSpiBus : public WiznetBus {
+
+public:
+    /** The fastest SPI clock that the W5100 supports, in Hz */
+    static const uint32_t MaxClock = 14000000;
+
+    /**
+     * Constructor that uses the default hardware SPI pins
+     * @param cs the Arduino Chip Select / Slave Select pin (default 10)
+     * @param clock the SPI clock in Hz, which is limited to MaxClock
+     */
+    WiznetSpiBus(int8_t cs=SS, uint32_t clock=W5100_SPI_CLOCK);
+
+    /**
+     * Change the SPI clock
+     * The SPI library uses the fastest clock it can that isn't faster than this.
+     * @param clock the SPI clock in Hz, which is limited to MaxClock
+     */
+    void setClock(uint32_t clock);
+
+    /**
+     * Get the SPI clock that was asked for
+     * @return the clock in Hz
+     */
+    uint32_t clock() const { return _clock; }
+
+    void begin();
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+    void readBuf(uint16_t address, uint8_t* pBuf, uint16_t len);
+    void writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len);
+
+protected:
+    WiznetChipSelect _cs;
+    uint32_t _clock;
+    SPISettings _settings;
+
+    /**
+     * Read one byte in a 4-byte frame, inside an SPI transaction
+     */
+    uint8_t readByte(uint16_t address);
+
+    /**
+     * Write one byte in a 4-byte frame, inside an SPI transaction
+     */
+    void writeByte(uint16_t address, uint8_t data);
+};
+
+
+/**
+ * SPI bus to a W5100 that moves buffers in the background, a byte at a time
+ *
+ * This is the reference for buses with submitRead() and submitWrite().
+ * Each 4-byte SPI frame is sent by a small state machine, which
+ * handleInterrupt() moves on by one byte each time the SPI peripheral
+ * finishes shifting one. On AVR with W5100_SPI_INTERRUPT set, the SPI
+ * interrupt calls it. Otherwise Wiznet5100::poll() calls service(), which
+ * moves up to ServiceBytes SPI bytes each time, so the transfer goes along
+ * in between the application's own work.
+ */
+class WiznetSpiInterruptBus : public WiznetSpiBus {
+
+public:
+    /** SPI bytes moved by each call to service(), when not driven by an interrupt */
+    static const uint8_t ServiceBytes = 32;
+
+    /**
+     * Constructor that uses the default hardware SPI pins
+     * @param cs the Arduino Chip Select / Slave Select pin (default 10)
+     * @param clock the SPI clock in Hz, which is limited to MaxClock
+     */
+    WiznetSpiInterruptBus(int8_t cs=SS, uint32_t clock=W5100_SPI_CLOCK);
+
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+    void readBuf(uint16_t address, uint8_t* pBuf, uint16_t len);
+    void writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len);
+    void submitRead(uint16_t address, uint8_t* pBuf, uint16_t len, Completion done, void *context);
+    void submitWrite(uint16_t address, const uint8_t* pBuf, uint16_t len, Completion done, void *context);
+    void service();
+    void cancel();
+
+    /**
+     * Check whether a transfer is in progress
+     * @return true until the transfer's completion has been called
+     */
+    boolean busy() const { return _busy; }
+
+    /**
+     * Move the transfer on, once the SPI peripheral has finished a byte
+     * Only one WiznetSpiInterruptBus can have a transfer in progress at a time.
+     */
+    void handleInterrupt();
+
+private:
+    volatile boolean _busy;
+    boolean _writing;
+    uint16_t _address;
+    uint8_t *_rx_buf;
+    const uint8_t *_tx_buf;
+    uint16_t _len;
+    uint16_t _pos;          /* Byte of the buffer being transferred */
+    uint8_t _phase;         /* Byte of its 4-byte SPI frame */
+    uint8_t _received;      /* Last byte read, when not driven by an interrupt */
+    Completion _done;
+    void *_context;
+
+    /**
+     * Start a transfer of a buffer
+     */
+    void submit(uint16_t address, uint8_t *rx_buf, const uint8_t *tx_buf, uint16_t len,
+                Completion done, void *context);
+
+    /**
+     * Get the next byte of the current SPI frame to send
+     */
+    uint8_t frameByte() const;
+
+    /**
+     * Start shifting a byte out
+     */
+    void startByte(uint8_t data);
+
+    /**
+     * Wait for any transfer in progress to finish
+     */
+    void finish();
+};
+
+
+/**
+ * SPI bus to a W5500, which looks like a W5100 to the driver
+ *
+ * Addresses in the W5100 map are translated into W5500 block selects,
+ * so the same Wiznet5100 code drives either chip. Every read or write of a
+ * buffer is a single burst with one chip select, rather than a 4-byte frame
+ * per byte as on the W5100.
+ *
+ * The W5100 RMSR and TMSR registers are kept here, and set the size of the
+ * W5500 socket buffers in the same way. IR and IMR are split between the
+ * W5500 common and socket interrupt registers.
+ */
+class WiznetW5500Bus : public WiznetBus {
+
+public:
+    /** The fastest SPI clock that the W5500 is guaranteed to support, in Hz */
+    static const uint32_t MaxClock = 33000000;
+
+    /**
+     * Constructor that uses the default hardware SPI pins
+     * @param cs the Arduino Chip Select / Slave Select pin (default 10)
+     * @param clock the SPI clock in Hz, which is limited to MaxClock
+     */
+    WiznetW5500Bus(int8_t cs=SS, uint32_t clock=W5100_SPI_CLOCK);
+
+    /**
+     * Change the SPI clock
+     * @param clock the SPI clock in Hz, which is limited to MaxClock
+     * @sa WiznetSpiBus::setClock()
+     */
+    void setClock(uint32_t clock);
+
+    /**
+     * Get the SPI clock that was asked for
+     * @return the clock in Hz
+     */
+    uint32_t clock() const { return _clock; }
+
+    void begin();
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+    void readBuf(uint16_t address, uint8_t* pBuf, uint16_t len);
+    void writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len);
+
+private:
+    WiznetChipSelect _cs;
+    uint32_t _clock;
+    SPISettings _settings;
+    uint8_t _rmsr;      /* W5100 Receive Memory Size, which the W5500 doesn't have */
+    uint8_t _tmsr;      /* W5100 Transmit Memory Size */
+
+    /**
+     * Translate an address in the W5100 map
+     * @param address the W5100 address, changed to the address within the block
+     * @return the W5500 block select
+     */
+    uint8_t translate(uint16_t &address);
+
+    /**
+     * Find the W5500 buffer block for an address in W5100 buffer memory
+     * @param msr the RMSR or TMSR value that shares out the memory
+     * @param offset the offset into the memory, changed to the offset into the socket's buffer
+     * @return the socket number
+     */
+    static uint8_t findBuffer(uint8_t msr, uint16_t &offset);
+
+    /**
+     * Set the W5500 buffer sizes to match a W5100 RMSR or TMSR value
+     * @param sizeRegister Sn_RXBUF_SIZE or Sn_TXBUF_SIZE
+     * @param msr the RMSR or TMSR value
+     */
+    void setBufferSizes(uint8_t sizeRegister, uint8_t msr);
+
+    /**
+     * Read data from the chip in one burst
+     * @param block the block select
+     * @param address the address within the block
+     * @param pBuf Pointer buffer to read data
+     * @param len Data length
+     */
+    void burstRead(uint8_t block, uint16_t address, uint8_t* pBuf, uint16_t len);
+
+    /**
+     * Write data to the chip in one burst
+     * @param block the block select
+     * @param address the address within the block
+     * @param pBuf Pointer buffer to write data
+     * @param len Data length
+     */
+    void burstWrite(uint8_t block, uint16_t address, const uint8_t* pBuf, uint16_t len);
+
+    /**
+     * Start a burst by selecting the chip and sending the address and control byte
+     */
+    void burstStart(uint8_t block, uint16_t address, uint8_t control);
+};
+
+
+/**
+ * Parallel bus to a W5100, using the Indirect Bus Interface mode
+ *
+ * Only the data pins, two address pins and the CS, RD and WR pins are needed.
+ * The address is written once per transfer, after which the chip increments it
+ * automatically, so buffers are moved with one bus cycle per byte.
+ *
+ * The pins are accessed through their port registers. If the data pins are
+ * bits 0 to 7 of a single AVR port, the whole port is written at once.
+ */
+class WiznetParallelBus : public WiznetBus {
+
+public:
+    /**
+     * @param data the Arduino pins connected to D0 to D7
+     * @param addr0 the Arduino pin connected to ADDR0
+     * @param addr1 the Arduino pin connected to ADDR1
+     * @param cs the Arduino pin connected to /CS
+     * @param rd the Arduino pin connected to /RD
+     * @param wr the Arduino pin connected to /WR
+     */
+    WiznetParallelBus(const uint8_t data[8], uint8_t addr0, uint8_t addr1,
+                      uint8_t cs, uint8_t rd, uint8_t wr);
+
+    void begin();
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+    void readBuf(uint16_t address, uint8_t* pBuf, uint16_t len);
+    void writeBuf(uint16_t address, const uint8_t* pBuf, uint16_t len);
+
+private:
+#if defined(__AVR__)
+    typedef volatile uint8_t PortReg;
+    typedef uint8_t PortMask;
+#else
+    typedef volatile uint32_t PortReg;
+    typedef uint32_t PortMask;
+#endif
+
+    /** A pin resolved to its port registers */
+    struct Pin {
+        uint8_t number;
+        PortReg *out;
+        PortReg *in;
+        PortReg *mode;
+        PortMask mask;
+    };
+
+    /** Indirect Bus Interface registers, selected by ADDR1 and ADDR0 */
+    enum {
+        IDM_MR = 0,     ///< Mode Register
+        IDM_AR0 = 1,    ///< Indirect Mode Address Register, high byte
+        IDM_AR1 = 2,    ///< Indirect Mode Address Register, low byte
+        IDM_DR = 3,     ///< Indirect Mode Data Register
+    };
+
+    Pin _data[8];
+    Pin _addr0, _addr1;
+    Pin _cs, _rd, _wr;
+    boolean _whole_port;    /* The data pins are bits 0-7 of one port */
+    boolean _data_output;   /* The data pins are currently outputs */
+
+    static void resolve(Pin &pin, uint8_t number);
+
+    static inline void set(const Pin &pin) { *pin.out |= pin.mask; }
+    static inline void clear(const Pin &pin) { *pin.out &= ~pin.mask; }
+
+    void setDataDirection(boolean output);
+    void setAddress(uint8_t reg);
+    void busWrite(uint8_t data);
+    uint8_t busRead();
+
+    /**
+     * Set the Indirect Mode Address Register
+     * @param address the chip address for the next data access
+     */
+    void setIndirectAddress(uint16_t address);
+
+    /**
+     * Read or write the mode register, which is accessed directly
+     * and must keep indirect mode and auto-increment enabled
+     */
+    uint8_t readMode();
+    void writeMode(uint8_t mode);
+};
+
+#endif // W5100_BUS_H
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_CONFIG_H
+#define	W5100_CONFIG_H
+
+/**
+ * Compile-time options for the Wiznet5100 driver
+ * Each can be changed here, or defined before this file is included.
+ */
+
+/**
+ * Set to 0 to remove the driver statistics, and the code that counts them
+ */
+#ifndef W5100_STATS
+#define W5100_STATS 1
+#endif
+
+/**
+ * Set to 1 to record timestamped driver events in a trace buffer
+ */
+#ifndef W5100_TRACE
+#define W5100_TRACE 0
+#endif
+
+/**
+ * The number of events kept in the trace buffer (at most 255)
+ */
+#ifndef W5100_TRACE_SIZE
+#define W5100_TRACE_SIZE 64
+#endif
+
+#if W5100_TRACE_SIZE < 1 || W5100_TRACE_SIZE > 255
+#error "W5100_TRACE_SIZE must be between 1 and 255"
+#endif
+
+/**
+ * The SPI clock for the WIZnet chip, in Hz
+ * The W5100 is specified up to 14 MHz, and the SPI library
+ * uses the fastest clock it can that isn't faster than this.
+ */
+#ifndef W5100_SPI_CLOCK
+#define W5100_SPI_CLOCK 14000000
+#endif
+
+/**
+ * Set to 1 on AVR to have the SPI interrupt move the bytes of
+ * WiznetSpiInterruptBus transfers. The library then defines the
+ * SPI_STC_vect interrupt handler, so nothing else can use it.
+ */
+#ifndef W5100_SPI_INTERRUPT
+#define W5100_SPI_INTERRUPT 0
+#endif
+
+/**
+ * How the 8kB of receive and transmit memory are split between the sockets
+ * These are the RMSR and TMSR values: 2 bits per socket, socket 0 in the lowest
+ * bits, 0=1kB, 1=2kB, 2=4kB, 3=8kB. Memory is given to each socket in turn,
+ * and sockets after it runs out get none. The default gives it all to socket 0.
+ * For example, 0x06 gives socket 0 4kB, socket 1 2kB and sockets 2 and 3 1kB each,
+ * for WiznetUdp to use.
+ */
+#ifndef W5100_RMSR
+#define W5100_RMSR 0x03
+#endif
+
+#ifndef W5100_TMSR
+#define W5100_TMSR 0x03
+#endif
+
+/**
+ * The time allowed for sendFrame(), forwardFrame(), end() and the other
+ * operations that wait for the chip, in microseconds, unless changed with setTimeout()
+ * Long enough for a frame already being sent and then one more.
+ */
+#ifndef W5100_TIMEOUT
+#define W5100_TIMEOUT 250000
+#endif
+
+/**
+ * The number of EtherTypes that can be added to the receive filter (at most 255)
+ */
+#ifndef W5100_ETHERTYPE_FILTER_SIZE
+#define W5100_ETHERTYPE_FILTER_SIZE 4
+#endif
+
+#if W5100_ETHERTYPE_FILTER_SIZE < 1 || W5100_ETHERTYPE_FILTER_SIZE > 255
+#error "W5100_ETHERTYPE_FILTER_SIZE must be between 1 and 255"
+#endif
+
+/**
+ * The number of EtherTypes that an EthernetDispatcher can hold (a power of 2)
+ */
+#ifndef W5100_DISPATCH_SIZE
+#define W5100_DISPATCH_SIZE 8
+#endif
+
+#if W5100_DISPATCH_SIZE < 1 || W5100_DISPATCH_SIZE > 128 || (W5100_DISPATCH_SIZE & (W5100_DISPATCH_SIZE - 1))
+#error "W5100_DISPATCH_SIZE must be a power of 2, up to 128"
+#endif
+
+/**
+ * The number of records that a FrameLog can hold before it drops them (at most 255)
+ */
+#ifndef W5100_LOG_SIZE
+#define W5100_LOG_SIZE 8
+#endif
+
+#if W5100_LOG_SIZE < 1 || W5100_LOG_SIZE > 255
+#error "W5100_LOG_SIZE must be between 1 and 255"
+#endif
+
+/**
+ * The number of IP addresses that EthernetIPv4 remembers the MAC address of (at most 255)
+ */
+#ifndef W5100_ARP_CACHE_SIZE
+#define W5100_ARP_CACHE_SIZE 4
+#endif
+
+#if W5100_ARP_CACHE_SIZE < 1 || W5100_ARP_CACHE_SIZE > 255
+#error "W5100_ARP_CACHE_SIZE must be between 1 and 255"
+#endif
+
+/**
+ * The number of UDP ports that EthernetIPv4 can have handlers for (at most 255)
+ */
+#ifndef W5100_UDP_HANDLERS
+#define W5100_UDP_HANDLERS 4
+#endif
+
+#if W5100_UDP_HANDLERS < 1 || W5100_UDP_HANDLERS > 255
+#error "W5100_UDP_HANDLERS must be between 1 and 255"
+#endif
+
+/**
+ * The number of frame buffers in the driver's frame pool (at most 254)
+ * Set to 0 to leave out the pool, and the readFrame() and sendFrame() that use it
+ */
+#ifndef W5100_POOL_FRAMES
+#define W5100_POOL_FRAMES 0
+#endif
+
+/**
+ * The size of each frame buffer in the pool, in bytes
+ */
+#ifndef W5100_POOL_FRAME_SIZE
+#define W5100_POOL_FRAME_SIZE 1514
+#endif
+
+#if W5100_POOL_FRAMES < 0 || W5100_POOL_FRAMES > 254
+#error "W5100_POOL_FRAMES must be between 0 and 254"
+#endif
+
+#endif // W5100_CONFIG_H
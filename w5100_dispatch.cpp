@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_dispatch.h"
+
+#include <string.h>
+
+EthernetDispatcher::EthernetDispatcher(Wiznet5100 &driver) :
+    _driver(driver)
+{
+    memset(_table, 0, sizeof(_table));
+    _default_handler = NULL;
+    _default_context = NULL;
+    _unhandled = 0;
+}
+
+EthernetDispatcher::Entry *EthernetDispatcher::find(uint16_t ethertype)
+{
+    // The common EtherTypes differ in both bytes, so fold them together
+    uint8_t slot = ((ethertype >> 8) ^ ethertype) & TableMask;
+
+    // Linear probing - entries are never removed, only their handler cleared
+    for (uint8_t i = 0; i < W5100_DISPATCH_SIZE; i++) {
+        Entry *entry = &_table[(slot + i) & TableMask];
+        if (!entry->used || entry->ethertype == ethertype)
+            return entry;
+    }
+
+    return NULL;
+}
+
+boolean EthernetDispatcher::addHandler(uint16_t ethertype, Handler handler, void *context)
+{
+    Entry *entry = find(ethertype);
+    if (entry == NULL)
+        return false;
+
+    entry->ethertype = ethertype;
+    entry->used = true;
+    entry->handler = handler;
+    entry->context = context;
+    return true;
+}
+
+void EthernetDispatcher::setDefaultHandler(Handler handler, void *context)
+{
+    _default_handler = handler;
+    _default_context = context;
+}
+
+boolean EthernetDispatcher::dispatch()
+{
+    Wiznet5100::FrameReader frame = _driver.beginFrame();
+    if (!frame)
+        return false;
+
+    const uint8_t *data = frame.header();
+    Header header;
+    header.destination = &data[0];
+    header.source = &data[6];
+    header.ethertype = (data[12] << 8) | data[13];
+    header.tagged = false;
+    header.tci = 0;
+    header.length = 14;
+    frame.skip(14);
+
+    if (header.ethertype == VlanTagType) {
+        // The tag is just after the cached header, so it costs one short read
+        uint8_t tag[4];
+        if (frame.read(tag, sizeof(tag)) == sizeof(tag)) {
+            header.tagged = true;
+            header.tci = (tag[0] << 8) | tag[1];
+            header.ethertype = (tag[2] << 8) | tag[3];
+            header.length += sizeof(tag);
+        }
+    }
+
+    Handler handler = _default_handler;
+    void *context = _default_context;
+    Entry *entry = find(header.ethertype);
+    if (entry && entry->used && entry->handler) {
+        handler = entry->handler;
+        context = entry->context;
+    }
+
+    if (handler) {
+        handler(header, frame, context);
+    } else {
+        _unhandled++;
+    }
+
+    // Release the frame if the handler didn't
+    frame.end();
+    return true;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_DISPATCH_H
+#define	W5100_DISPATCH_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "w5100.h"
+
+/**
+ * Passes received frames to a handler for their EtherType
+ *
+ * Handlers are kept in a small hash table, so finding the handler for a
+ * frame takes the same time however many are registered. Frames with no
+ * handler are released without their payload being read from the chip.
+ */
+class EthernetDispatcher {
+
+public:
+    /** The parsed Ethernet header of a received frame */
+    struct Header {
+        const uint8_t *destination; ///< Destination MAC address (6 bytes)
+        const uint8_t *source;      ///< Source MAC address (6 bytes)
+        uint16_t ethertype;         ///< EtherType of the payload, after any VLAN tag
+        boolean tagged;             ///< The frame has an 802.1Q VLAN tag
+        uint16_t tci;               ///< 802.1Q Tag Control Information, or 0 if not tagged
+        uint16_t length;            ///< Length of the header, including any VLAN tag
+
+        /** @return the VLAN identifier from the tag */
+        uint16_t vlan() const { return tci & 0x0FFF; }
+
+        /** @return the priority code point from the tag */
+        uint8_t priority() const { return tci >> 13; }
+    };
+
+    /**
+     * Callback for a received frame
+     * The frame is positioned at the start of the payload, after the header.
+     * If the handler doesn't end, forward or reflect the frame, it is ended for it.
+     *
+     * @param header the parsed Ethernet header
+     * @param frame the received frame, for reading the payload
+     * @param context the pointer that was passed to addHandler()
+     */
+    typedef void (*Handler)(const Header &header, Wiznet5100::FrameReader &frame, void *context);
+
+    /**
+     * @param driver the driver to receive frames from
+     */
+    EthernetDispatcher(Wiznet5100 &driver);
+
+    /**
+     * Register the handler for an EtherType, replacing any existing handler
+     * Frames with a VLAN tag are dispatched on the EtherType inside the tag.
+     *
+     * @param ethertype the EtherType, such as 0x0800 for IPv4
+     * @param handler the function to call, or NULL to stop handling the EtherType
+     * @param context a pointer to pass to the handler
+     * @return false if the table is full
+     */
+    boolean addHandler(uint16_t ethertype, Handler handler, void *context = NULL);
+
+    /**
+     * Set the handler for frames with no EtherType handler
+     * @param handler the function to call, or NULL to drop them (the default)
+     * @param context a pointer to pass to the handler
+     */
+    void setDefaultHandler(Handler handler, void *context = NULL);
+
+    /**
+     * Receive a frame and pass it to its handler
+     * @return true if a frame was received
+     */
+    boolean dispatch();
+
+    /**
+     * Get the number of frames that were dropped because they had no handler
+     * @return the number of frames
+     */
+    uint32_t unhandled() const { return _unhandled; }
+
+private:
+    static const uint16_t VlanTagType = 0x8100;  /* 802.1Q Tag Protocol Identifier */
+    static const uint8_t TableMask = W5100_DISPATCH_SIZE - 1;
+
+    struct Entry {
+        uint16_t ethertype;
+        boolean used;
+        Handler handler;
+        void *context;
+    };
+
+    /**
+     * Find the table slot for an EtherType
+     * @param ethertype the EtherType
+     * @return the slot holding it, the empty slot where it would go,
+     *         or NULL if it isn't there and the table is full
+     */
+    Entry *find(uint16_t ethertype);
+
+    Wiznet5100 &_driver;
+    Entry _table[W5100_DISPATCH_SIZE];
+    Handler _default_handler;
+    void *_default_context;
+    uint32_t _unhandled;
+};
+
+#endif // W5100_DISPATCH_H
@@ -0,0 +1,510 @@
+/*
+ * IPv4, ARP, ICMP echo and UDP on the MACRAW socket
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_ip.h"
+
+#include <string.h>
+
+static const uint8_t BroadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+void InternetChecksum::add(const uint8_t *data, uint16_t len)
+{
+    uint16_t i = 0;
+
+    // Finish the word that the last piece ended half way through
+    if (_odd && len > 0) {
+        _sum += data[0];
+        _odd = false;
+        i = 1;
+    }
+
+    for (; i + 1 < len; i += 2) {
+        _sum += (data[i] << 8) | data[i + 1];
+    }
+
+    if (i < len) {
+        _sum += data[i] << 8;
+        _odd = true;
+    }
+}
+
+uint16_t InternetChecksum::result() const
+{
+    uint32_t sum = _sum;
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return ~sum & 0xFFFF;
+}
+
+uint16_t EthernetIPv4::UdpReader::read(uint8_t *dst, uint16_t n)
+{
+    if (n > _remaining)
+        n = _remaining;
+
+    n = _frame.read(dst, n);
+    _checksum.add(dst, n);
+    _remaining -= n;
+    return n;
+}
+
+boolean EthernetIPv4::UdpReader::valid()
+{
+    uint8_t buf[32];
+
+    // The checksum covers all of the payload, even the parts not wanted
+    while (_remaining > 0) {
+        if (read(buf, sizeof(buf)) == 0)
+            return false;
+    }
+
+    return _unchecked || _checksum.result() == 0;
+}
+
+EthernetIPv4::EthernetIPv4(Wiznet5100 &driver, EthernetDispatcher &dispatcher) :
+    _driver(driver), _dispatcher(dispatcher)
+{
+    memset(_address, 0, sizeof(_address));
+    memset(_subnet_mask, 0, sizeof(_subnet_mask));
+    memset(_gateway, 0, sizeof(_gateway));
+    _ident = 0;
+    memset(_arp, 0, sizeof(_arp));
+    _arp_next = 0;
+    memset(_arp_asked, 0, sizeof(_arp_asked));
+    _arp_asked_time = 0;
+    memset(_udp, 0, sizeof(_udp));
+    _checksum_errors = 0;
+    _arp_dropped = 0;
+}
+
+boolean EthernetIPv4::begin(const uint8_t *address, const uint8_t *subnet_mask, const uint8_t *gateway)
+{
+    memcpy(_address, address, 4);
+    memcpy(_subnet_mask, subnet_mask, 4);
+    memcpy(_gateway, gateway, 4);
+
+    return _dispatcher.addHandler(EtherTypeArp, handleArp, this) &&
+           _dispatcher.addHandler(EtherTypeIPv4, handleIPv4, this);
+}
+
+boolean EthernetIPv4::addUdpHandler(uint16_t port, UdpHandler handler, void *context)
+{
+    UdpEntry *entry = NULL;
+
+    for (uint8_t i = 0; i < W5100_UDP_HANDLERS; i++) {
+        if (_udp[i].handler && _udp[i].port == port) {
+            entry = &_udp[i];
+            break;
+        }
+        if (!_udp[i].handler && !entry) {
+            entry = &_udp[i];
+        }
+    }
+
+    if (entry == NULL)
+        return handler == NULL;
+
+    entry->port = port;
+    entry->handler = handler;
+    entry->context = context;
+    return true;
+}
+
+boolean EthernetIPv4::isBroadcast(const uint8_t *address) const
+{
+    boolean limited = true, directed = true;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (address[i] != 0xFF)
+            limited = false;
+        if ((address[i] | _subnet_mask[i]) != 0xFF || ((address[i] ^ _address[i]) & _subnet_mask[i]))
+            directed = false;
+    }
+
+    return limited || directed;
+}
+
+EthernetIPv4::ArpEntry *EthernetIPv4::findArp(const uint8_t *address)
+{
+    for (uint8_t i = 0; i < W5100_ARP_CACHE_SIZE; i++) {
+        if (_arp[i].used && memcmp(_arp[i].address, address, 4) == 0)
+            return &_arp[i];
+    }
+
+    return NULL;
+}
+
+boolean EthernetIPv4::resolve(const uint8_t *address, uint8_t *mac)
+{
+    const uint8_t *hop = address;
+
+    if (isBroadcast(address)) {
+        memcpy(mac, BroadcastMac, 6);
+        return true;
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if ((address[i] ^ _address[i]) & _subnet_mask[i])
+            hop = _gateway;
+    }
+
+    ArpEntry *entry = findArp(hop);
+    if (entry) {
+        memcpy(mac, entry->mac, 6);
+        return true;
+    }
+
+    // Don't flood the network when the caller tries again straight away,
+    // but a request that couldn't be sent is tried again the next time
+    if ((memcmp(_arp_asked, hop, 4) != 0 || WiznetBus::expired(_arp_asked_time, ArpRetryMicros)) &&
+        sendArp(ArpRequest, BroadcastMac, hop)) {
+        memcpy(_arp_asked, hop, 4);
+        _arp_asked_time = micros();
+    }
+
+    return false;
+}
+
+boolean EthernetIPv4::sendArp(uint16_t op, const uint8_t *mac, const uint8_t *address)
+{
+    uint8_t packet[14 + ArpLength];
+    uint8_t *arp = &packet[14];
+
+    memcpy(&packet[0], mac, 6);
+    memcpy(&packet[6], _driver.macAddress(), 6);
+    packet[12] = EtherTypeArp >> 8;
+    packet[13] = EtherTypeArp & 0xFF;
+
+    // Ethernet hardware addresses, IPv4 protocol addresses
+    arp[0] = 0x00;
+    arp[1] = 0x01;
+    arp[2] = EtherTypeIPv4 >> 8;
+    arp[3] = EtherTypeIPv4 & 0xFF;
+    arp[4] = 6;
+    arp[5] = 4;
+    arp[6] = op >> 8;
+    arp[7] = op & 0xFF;
+    memcpy(&arp[8], _driver.macAddress(), 6);
+    memcpy(&arp[14], _address, 4);
+    if (op == ArpReply) {
+        memcpy(&arp[18], mac, 6);
+    } else {
+        memset(&arp[18], 0, 6);
+    }
+    memcpy(&arp[24], address, 4);
+
+    // This is called while dispatching, so it can't wait for room,
+    // and the other end will ask again
+    if (!_driver.sendFrameAsync(packet, sizeof(packet))) {
+        _arp_dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+void EthernetIPv4::handleArp(const EthernetDispatcher::Header &, Wiznet5100::FrameReader &frame, void *context)
+{
+    EthernetIPv4 *self = (EthernetIPv4 *)context;
+    uint8_t arp[ArpLength];
+
+    if (frame.read(arp, sizeof(arp)) != sizeof(arp))
+        return;
+
+    if (arp[0] != 0x00 || arp[1] != 0x01 ||
+        arp[2] != (EtherTypeIPv4 >> 8) || arp[3] != (EtherTypeIPv4 & 0xFF) ||
+        arp[4] != 6 || arp[5] != 4)
+        return;
+
+    uint16_t op = (arp[6] << 8) | arp[7];
+    const uint8_t *sender_mac = &arp[8];
+    const uint8_t *sender_ip = &arp[14];
+    const uint8_t *target_ip = &arp[24];
+    boolean for_us = memcmp(target_ip, self->_address, 4) == 0;
+
+    // Update the sender if it is already known, and add it if it
+    // was talking to us, as RFC 826 does. Probes from 0.0.0.0 are not learnt.
+    ArpEntry *entry = self->findArp(sender_ip);
+    if (entry == NULL && for_us && (sender_ip[0] | sender_ip[1] | sender_ip[2] | sender_ip[3])) {
+        entry = &self->_arp[self->_arp_next];
+        self->_arp_next = (self->_arp_next + 1) % W5100_ARP_CACHE_SIZE;
+    }
+    if (entry) {
+        memcpy(entry->address, sender_ip, 4);
+        memcpy(entry->mac, sender_mac, 6);
+        entry->used = true;
+    }
+
+    if (for_us && op == ArpRequest) {
+        self->sendArp(ArpReply, sender_mac, sender_ip);
+    }
+}
+
+void EthernetIPv4::handleIPv4(const EthernetDispatcher::Header &header, Wiznet5100::FrameReader &frame, void *context)
+{
+    EthernetIPv4 *self = (EthernetIPv4 *)context;
+    uint8_t ip[60];
+    uint8_t ihl;
+    uint16_t total;
+
+    if (frame.read(ip, IpHeaderLength) != IpHeaderLength)
+        return;
+
+    ihl = (ip[0] & 0x0F) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < IpHeaderLength)
+        return;
+    if (frame.read(&ip[IpHeaderLength], ihl - IpHeaderLength) != ihl - IpHeaderLength)
+        return;
+
+    InternetChecksum checksum;
+    checksum.add(ip, ihl);
+    if (checksum.result() != 0) {
+        self->_checksum_errors++;
+        return;
+    }
+
+    // The frame may be padded after the packet, but mustn't be shorter than it
+    total = (ip[2] << 8) | ip[3];
+    if (total < ihl || total - ihl > frame.remaining())
+        return;
+
+    // Fragments would need reassembling in RAM, so the More Fragments
+    // flag and the fragment offset must both be clear
+    if ((ip[6] & 0x3F) || ip[7])
+        return;
+
+    if (memcmp(&ip[16], self->_address, 4) != 0 && !self->isBroadcast(&ip[16]))
+        return;
+
+    switch (ip[9]) {
+    case ProtocolIcmp:
+        self->replyToEcho(frame, ip, header.length);
+        break;
+    case ProtocolUdp:
+        self->receiveUdp(frame, ip, total - ihl);
+        break;
+    }
+}
+
+void EthernetIPv4::applyPatch(uint8_t *data, uint16_t offset, uint16_t len, void *context)
+{
+    const Patch *patch = (const Patch *)context;
+    uint16_t start = offset > patch->offset ? offset : patch->offset;
+    uint16_t end = offset + len;
+
+    // The frame goes through in pieces, which may split the patch
+    if (end > patch->offset + patch->length)
+        end = patch->offset + patch->length;
+    if (start < end)
+        memcpy(&data[start - offset], &patch->data[start - patch->offset], end - start);
+}
+
+void EthernetIPv4::replyToEcho(Wiznet5100::FrameReader &frame, const uint8_t *ip, uint16_t offset)
+{
+    uint8_t ihl = (ip[0] & 0x0F) * 4;
+    uint8_t icmp[4];
+    Patch patch;
+
+    // Pings to a broadcast address are not answered
+    if (memcmp(&ip[16], _address, 4) != 0)
+        return;
+    if (frame.read(icmp, sizeof(icmp)) != sizeof(icmp) || icmp[0] != IcmpEchoRequest)
+        return;
+
+    // New IP header, with the addresses swapped
+    patch.offset = offset;
+    patch.length = ihl + sizeof(icmp);
+    memcpy(patch.data, ip, ihl);
+    memcpy(&patch.data[12], &ip[16], 4);
+    memcpy(&patch.data[16], &ip[12], 4);
+    patch.data[8] = TimeToLive;
+    patch.data[10] = 0;
+    patch.data[11] = 0;
+    InternetChecksum ip_checksum;
+    ip_checksum.add(patch.data, ihl);
+    uint16_t checksum = ip_checksum.result();
+    patch.data[10] = checksum >> 8;
+    patch.data[11] = checksum & 0xFF;
+
+    // Only the type changes in the ICMP message, so its checksum is
+    // updated for the change (RFC 1624) rather than read through again
+    InternetChecksum icmp_checksum;
+    icmp_checksum.addWord((uint16_t)~((icmp[2] << 8) | icmp[3]));
+    icmp_checksum.addWord((uint16_t)~((icmp[0] << 8) | icmp[1]));
+    icmp_checksum.addWord((IcmpEchoReply << 8) | icmp[1]);
+    checksum = icmp_checksum.result();
+    patch.data[ihl] = IcmpEchoReply;
+    patch.data[ihl + 1] = icmp[1];
+    patch.data[ihl + 2] = checksum >> 8;
+    patch.data[ihl + 3] = checksum & 0xFF;
+
+    _driver.reflectFrame(frame, applyPatch, &patch);
+}
+
+void EthernetIPv4::receiveUdp(Wiznet5100::FrameReader &frame, const uint8_t *ip, uint16_t len)
+{
+    uint8_t udp[UdpHeaderLength];
+    uint16_t udp_len;
+    Datagram datagram;
+    UdpEntry *entry = NULL;
+
+    if (len < UdpHeaderLength || frame.read(udp, sizeof(udp)) != sizeof(udp))
+        return;
+
+    udp_len = (udp[4] << 8) | udp[5];
+    if (udp_len < UdpHeaderLength || udp_len > len)
+        return;
+
+    datagram.source = &ip[12];
+    datagram.destination = &ip[16];
+    datagram.source_port = (udp[0] << 8) | udp[1];
+    datagram.port = (udp[2] << 8) | udp[3];
+    datagram.length = udp_len - UdpHeaderLength;
+
+    for (uint8_t i = 0; i < W5100_UDP_HANDLERS; i++) {
+        if (_udp[i].handler && _udp[i].port == datagram.port) {
+            entry = &_udp[i];
+            break;
+        }
+    }
+    if (entry == NULL)
+        return;
+
+    // The checksum starts with a pseudo header of the addresses,
+    // protocol and length, and the payload is added as it is read
+    UdpReader payload(frame, datagram.length);
+    payload._unchecked = (udp[6] | udp[7]) == 0;
+    payload._checksum.add(&ip[12], 8);
+    payload._checksum.addWord(ProtocolUdp);
+    payload._checksum.addWord(udp_len);
+    payload._checksum.add(udp, sizeof(udp));
+
+    entry->handler(datagram, payload, entry->context);
+}
+
+Wiznet5100::Status EthernetIPv4::sendTo(const uint8_t *address, uint16_t port, uint16_t source_port,
+                                        const uint8_t *data, uint16_t len)
+{
+    Wiznet5100::Segment segment = { data, len };
+    return sendToV(address, port, source_port, &segment, 1);
+}
+
+Wiznet5100::Status EthernetIPv4::sendToV(const uint8_t *address, uint16_t port, uint16_t source_port,
+                                         const Wiznet5100::Segment *segments, uint8_t count)
+{
+    uint8_t headers[HeadersLength];
+    uint8_t *ip = &headers[14];
+    uint8_t *udp = &ip[IpHeaderLength];
+    uint16_t len = 0;
+    uint32_t start = micros();
+
+    for (uint8_t i = 0; i < count; i++) {
+        len += segments[i].len;
+    }
+
+    if (len > MaxPayload || HeadersLength + len > Wiznet5100::maxFrameLength())
+        return Wiznet5100::StatusTooLong;
+
+    if (!resolve(address, &headers[0]))
+        return Wiznet5100::StatusUnresolved;
+    memcpy(&headers[6], _driver.macAddress(), 6);
+    headers[12] = EtherTypeIPv4 >> 8;
+    headers[13] = EtherTypeIPv4 & 0xFF;
+
+    uint16_t total = IpHeaderLength + UdpHeaderLength + len;
+    ip[0] = 0x45;       // Version 4, no options
+    ip[1] = 0;
+    ip[2] = total >> 8;
+    ip[3] = total & 0xFF;
+    ip[4] = _ident >> 8;
+    ip[5] = _ident & 0xFF;
+    ip[6] = 0;
+    ip[7] = 0;
+    ip[8] = TimeToLive;
+    ip[9] = ProtocolUdp;
+    ip[10] = 0;
+    ip[11] = 0;
+    memcpy(&ip[12], _address, 4);
+    memcpy(&ip[16], address, 4);
+    InternetChecksum ip_checksum;
+    ip_checksum.add(ip, IpHeaderLength);
+    uint16_t checksum = ip_checksum.result();
+    ip[10] = checksum >> 8;
+    ip[11] = checksum & 0xFF;
+    _ident++;
+
+    uint16_t udp_len = UdpHeaderLength + len;
+    udp[0] = source_port >> 8;
+    udp[1] = source_port & 0xFF;
+    udp[2] = port >> 8;
+    udp[3] = port & 0xFF;
+    udp[4] = udp_len >> 8;
+    udp[5] = udp_len & 0xFF;
+    udp[6] = 0;         // Filled in once the payload has been written
+    udp[7] = 0;
+
+    InternetChecksum udp_checksum;
+    udp_checksum.add(&ip[12], 8);
+    udp_checksum.addWord(ProtocolUdp);
+    udp_checksum.addWord(udp_len);
+    udp_checksum.add(udp, UdpHeaderLength);
+
+    // Wait for space in the transmit buffer
+    Wiznet5100::FrameWriter frame;
+    while (!(frame = _driver.beginSendFrame(HeadersLength + len)))
+    {
+        if (!_driver.isOpen())
+            return Wiznet5100::StatusClosed;
+        if (WiznetBus::expired(start, _driver.timeout()))
+            return Wiznet5100::StatusTimeout;
+        _driver.poll();
+    }
+
+    // The payload is added to the checksum as it goes to the chip
+    frame.write(headers, HeadersLength);
+    for (uint8_t i = 0; i < count; i++) {
+        frame.write(segments[i].data, segments[i].len);
+        udp_checksum.add(segments[i].data, segments[i].len);
+    }
+
+    // A checksum of 0 would mean that there isn't one
+    checksum = udp_checksum.result();
+    if (checksum == 0)
+        checksum = 0xFFFF;
+    uint8_t field[2] = { (uint8_t)(checksum >> 8), (uint8_t)(checksum & 0xFF) };
+    frame.writeAt(HeadersLength - 2, field, sizeof(field));
+    frame.send();
+
+    return Wiznet5100::StatusOk;
+}
@@ -0,0 +1,337 @@
+/*
+ * IPv4, ARP, ICMP echo and UDP on the MACRAW socket
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_IP_H
+#define	W5100_IP_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "w5100.h"
+#include "w5100_dispatch.h"
+
+/**
+ * The 16-bit one's complement sum used by IP, ICMP and UDP
+ *
+ * Data can be added a piece at a time as it goes to or from the chip,
+ * including pieces with an odd length.
+ */
+class InternetChecksum {
+
+public:
+    InternetChecksum() : _sum(0), _odd(false) {}
+
+    /**
+     * Add the next piece of data
+     * @param data a pointer to the data
+     * @param len the length of the data
+     */
+    void add(const uint8_t *data, uint16_t len);
+
+    /**
+     * Add a 16-bit word, when an even number of bytes have been added
+     * @param word the word
+     */
+    void addWord(uint16_t word) { _sum += word; }
+
+    /**
+     * Get the checksum of everything added
+     * @return the one's complement of the sum, which is 0 when a
+     *         packet with its checksum included is correct
+     */
+    uint16_t result() const;
+
+private:
+    uint32_t _sum;
+    boolean _odd;        /* The last byte added was the high byte of a word */
+};
+
+/**
+ * A minimal IPv4 host on the MACRAW socket
+ *
+ * It answers ARP requests and pings, and sends and receives UDP datagrams.
+ * Frames are never held in RAM: received datagrams are read from the
+ * receive buffer as the handler asks for them, and datagrams are written
+ * straight into the transmit buffer. The checksums are worked out along
+ * the way, and the UDP checksum is written into the transmit buffer last,
+ * just before the frame is sent.
+ *
+ * Frames come in through an EthernetDispatcher, which must have dispatch()
+ * called regularly. Fragmented datagrams and IP options on sent datagrams
+ * aren't supported.
+ */
+class EthernetIPv4 {
+
+public:
+    /** The addresses of a received datagram */
+    struct Datagram {
+        const uint8_t *source;      ///< IP address of the sender (4 bytes)
+        const uint8_t *destination; ///< IP address it was sent to, ours or a broadcast (4 bytes)
+        uint16_t source_port;       ///< UDP port of the sender
+        uint16_t port;              ///< UDP port it was sent to
+        uint16_t length;            ///< Length of the payload
+    };
+
+    /**
+     * The payload of a received datagram, read from the receive buffer a piece at a time
+     * The checksum is added up as the payload is read.
+     */
+    class UdpReader {
+    public:
+        /**
+         * Get the number of bytes of the payload that have not been read yet
+         * @return the number of bytes remaining
+         */
+        uint16_t remaining() const { return _remaining; }
+
+        /**
+         * Read the next part of the payload
+         * @param dst a pointer to a buffer to write the data to
+         * @param n the number of bytes to read
+         * @return the number of bytes read
+         */
+        uint16_t read(uint8_t *dst, uint16_t n);
+
+        /**
+         * Check the UDP checksum
+         * Any of the payload that has not been read is read now, so the
+         * handler should call this once it has read what it wants, and
+         * before acting on it.
+         *
+         * @return true if the checksum is correct or the sender didn't use one
+         */
+        boolean valid();
+
+    private:
+        friend class EthernetIPv4;
+
+        UdpReader(Wiznet5100::FrameReader &frame, uint16_t length) :
+            _frame(frame), _remaining(length), _unchecked(false) {}
+
+        Wiznet5100::FrameReader &_frame;
+        InternetChecksum _checksum;
+        uint16_t _remaining;
+        boolean _unchecked;     /* The sender set the checksum to 0 */
+    };
+
+    /**
+     * Callback for a received UDP datagram
+     * @param datagram the addresses and length of the datagram
+     * @param payload the payload, for reading it and checking its checksum
+     * @param context the pointer that was passed to addUdpHandler()
+     */
+    typedef void (*UdpHandler)(const Datagram &datagram, UdpReader &payload, void *context);
+
+    /**
+     * @param driver the driver to send frames with
+     * @param dispatcher the dispatcher that frames are received through
+     */
+    EthernetIPv4(Wiznet5100 &driver, EthernetDispatcher &dispatcher);
+
+    /**
+     * Set the addresses, and start handling ARP and IPv4 frames
+     * The driver must have been started with Wiznet5100::begin() first.
+     *
+     * @param address our 4-byte IP address
+     * @param subnet_mask the 4-byte subnet mask
+     * @param gateway the 4-byte IP address of the router, for other subnets
+     * @return false if the dispatcher has no room for the handlers
+     */
+    boolean begin(const uint8_t *address, const uint8_t *subnet_mask, const uint8_t *gateway);
+
+    /**
+     * Register the handler for a UDP port, replacing any existing handler
+     * @param port the local UDP port
+     * @param handler the function to call, or NULL to stop handling the port
+     * @param context a pointer to pass to the handler
+     * @return false if the table is full
+     */
+    boolean addUdpHandler(uint16_t port, UdpHandler handler, void *context = NULL);
+
+    /**
+     * Send a UDP datagram
+     *
+     * If the MAC address of the destination, or of the gateway, isn't known
+     * yet, an ARP request is sent and StatusUnresolved returned; it should be
+     * tried again once dispatch() has had a chance to receive the reply.
+     * This waits for space in the transmit buffer, for as long as was set
+     * with Wiznet5100::setTimeout(), but not for the frame to be sent.
+     *
+     * @param address the 4-byte IP address to send to
+     * @param port the UDP port to send to
+     * @param source_port the UDP port to send from
+     * @param data the payload
+     * @param len the length of the payload
+     * @return StatusOk if it was queued, StatusUnresolved, StatusTooLong if it
+     *         needs more than one frame, or StatusTimeout or StatusClosed
+     */
+    Wiznet5100::Status sendTo(const uint8_t *address, uint16_t port, uint16_t source_port,
+                              const uint8_t *data, uint16_t len);
+
+    /**
+     * Send a UDP datagram made from several pieces
+     * @param address the 4-byte IP address to send to
+     * @param port the UDP port to send to
+     * @param source_port the UDP port to send from
+     * @param segments the pieces of the payload, in order
+     * @param count the number of segments
+     * @return StatusOk if it was queued, or why it wasn't
+     * @sa sendTo()
+     */
+    Wiznet5100::Status sendToV(const uint8_t *address, uint16_t port, uint16_t source_port,
+                               const Wiznet5100::Segment *segments, uint8_t count);
+
+    /**
+     * Get the number of received IPv4 packets that were dropped
+     * because their header checksum was wrong
+     * @return the number of packets
+     */
+    uint32_t checksumErrors() const { return _checksum_errors; }
+
+    /**
+     * Get the number of ARP requests and replies that weren't sent
+     * because the transmit buffer was busy
+     * @return the number of packets
+     */
+    uint32_t arpDropped() const { return _arp_dropped; }
+
+private:
+    static const uint16_t EtherTypeIPv4 = 0x0800;
+    static const uint16_t EtherTypeArp = 0x0806;
+    static const uint8_t ProtocolIcmp = 1;
+    static const uint8_t ProtocolUdp = 17;
+    static const uint8_t IcmpEchoReply = 0;
+    static const uint8_t IcmpEchoRequest = 8;
+    static const uint16_t ArpRequest = 1;
+    static const uint16_t ArpReply = 2;
+    static const uint8_t ArpLength = 28;         /* ARP packet for IPv4 over Ethernet */
+    static const uint8_t IpHeaderLength = 20;   /* IPv4 header without options */
+    static const uint8_t UdpHeaderLength = 8;
+    static const uint8_t HeadersLength = 14 + IpHeaderLength + UdpHeaderLength;
+    static const uint16_t MaxPayload = 1500 - IpHeaderLength - UdpHeaderLength;
+    static const uint8_t TimeToLive = 64;
+    static const uint32_t ArpRetryMicros = 100000; /* Time before asking for the same address again */
+
+    struct ArpEntry {
+        uint8_t address[4];
+        uint8_t mac[6];
+        boolean used;
+    };
+
+    struct UdpEntry {
+        uint16_t port;
+        UdpHandler handler;
+        void *context;
+    };
+
+    /**
+     * Bytes to replace while a received frame is reflected, for answering a ping
+     * The replacement covers the IP header and the start of the ICMP header.
+     */
+    struct Patch {
+        uint16_t offset;    /* Position of the replacement in the frame */
+        uint8_t length;
+        uint8_t data[60 + 4];
+    };
+
+    static void handleArp(const EthernetDispatcher::Header &header, Wiznet5100::FrameReader &frame, void *context);
+    static void handleIPv4(const EthernetDispatcher::Header &header, Wiznet5100::FrameReader &frame, void *context);
+    static void applyPatch(uint8_t *data, uint16_t offset, uint16_t len, void *context);
+
+    /**
+     * Answer a ping by sending the frame back with the addresses swapped
+     * @param frame the received frame, positioned after the IP header
+     * @param ip the IP header
+     * @param offset the position of the IP header in the frame
+     */
+    void replyToEcho(Wiznet5100::FrameReader &frame, const uint8_t *ip, uint16_t offset);
+
+    /**
+     * Pass a received datagram to the handler for its port
+     * @param frame the received frame, positioned after the IP header
+     * @param ip the IP header
+     * @param len the length of the UDP header and payload, from the IP header
+     */
+    void receiveUdp(Wiznet5100::FrameReader &frame, const uint8_t *ip, uint16_t len);
+
+    /**
+     * Check whether an address is a broadcast to every host on our subnet
+     * @param address the 4-byte IP address
+     * @return true for 255.255.255.255 and our subnet's broadcast address
+     */
+    boolean isBroadcast(const uint8_t *address) const;
+
+    /**
+     * Find the MAC address to send a packet to
+     * Addresses outside our subnet are sent to the gateway.
+     *
+     * @param address the 4-byte destination IP address
+     * @param mac set to the 6-byte MAC address
+     * @return false if it isn't known, in which case an ARP request has been sent
+     */
+    boolean resolve(const uint8_t *address, uint8_t *mac);
+
+    /**
+     * Find the ARP cache entry for an address
+     * @param address the 4-byte IP address
+     * @return the entry, or NULL if it isn't in the cache
+     */
+    ArpEntry *findArp(const uint8_t *address);
+
+    /**
+     * Send an ARP packet, without waiting
+     * @param op ArpRequest or ArpReply
+     * @param mac the MAC address to send it to, and the target hardware address of a reply
+     * @param address the target IP address
+     * @return true if it was sent, or false if the transmit buffer was busy
+     */
+    boolean sendArp(uint16_t op, const uint8_t *mac, const uint8_t *address);
+
+    Wiznet5100 &_driver;
+    EthernetDispatcher &_dispatcher;
+    uint8_t _address[4];
+    uint8_t _subnet_mask[4];
+    uint8_t _gateway[4];
+    uint16_t _ident;                /* Identification of the next IP packet sent */
+
+    ArpEntry _arp[W5100_ARP_CACHE_SIZE];
+    uint8_t _arp_next;              /* Entry to replace next when the cache is full */
+    uint8_t _arp_asked[4];          /* Address of the last ARP request sent */
+    uint32_t _arp_asked_time;       /* micros() when it was sent */
+
+    UdpEntry _udp[W5100_UDP_HANDLERS];
+    uint32_t _checksum_errors;
+    uint32_t _arp_dropped;
+};
+
+#endif // W5100_IP_H
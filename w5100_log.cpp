@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_log.h"
+
+#include <string.h>
+
+FrameLog::FrameLog()
+{
+    _first = 0;
+    _count = 0;
+    _unreported = 0;
+    _dropped = 0;
+}
+
+boolean FrameLog::add(const uint8_t *destination, const uint8_t *source,
+                      uint16_t ethertype, uint16_t length, uint8_t value)
+{
+    if (_count == W5100_LOG_SIZE) {
+        // The newest record is the one before the oldest. The drop is
+        // counted against it, and reported once it has been written out.
+        _records[(_first == 0 ? W5100_LOG_SIZE : _first) - 1].dropped++;
+        _dropped++;
+        return false;
+    }
+
+    uint16_t index = _first + _count;
+    if (index >= W5100_LOG_SIZE)
+        index -= W5100_LOG_SIZE;
+
+    Record &record = _records[index];
+    memcpy(record.destination, destination, 6);
+    memcpy(record.source, source, 6);
+    record.ethertype = ethertype;
+    record.length = length;
+    record.value = value;
+    record.dropped = 0;
+    _count++;
+
+    return true;
+}
+
+boolean FrameLog::drain(Print &out)
+{
+    uint8_t buf[RecordLength];
+
+    if (_unreported) {
+        buf[0] = Marker;
+        buf[1] = DroppedRecord;
+        for (uint8_t i = 0; i < 4; i++) {
+            buf[2 + i] = _unreported >> (8 * i);
+        }
+        out.write(buf, 6);
+        _unreported = 0;
+        return true;
+    }
+
+    if (_count == 0)
+        return false;
+
+    const Record &record = _records[_first];
+    buf[0] = Marker;
+    buf[1] = FrameRecord;
+    buf[2] = record.length & 0xFF;
+    buf[3] = record.length >> 8;
+    memcpy(&buf[4], record.destination, 6);
+    memcpy(&buf[10], record.source, 6);
+    buf[16] = record.ethertype & 0xFF;
+    buf[17] = record.ethertype >> 8;
+    buf[18] = record.value;
+    out.write(buf, sizeof(buf));
+
+    _unreported = record.dropped;
+    if (++_first == W5100_LOG_SIZE)
+        _first = 0;
+    _count--;
+
+    return true;
+}
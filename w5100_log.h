@@ -0,0 +1,127 @@
+/*
+ * Log of received frames, written out in binary when there is time
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_LOG_H
+#define	W5100_LOG_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "w5100_config.h"
+
+/**
+ * A ring of compact binary records about received frames
+ *
+ * Adding a record copies a few bytes into RAM, so it can be done for every
+ * frame without slowing down the reply. The records are written out later,
+ * one at a time, when there is nothing else to do. If the ring is full, the
+ * record is dropped and counted, and the count is written out where the
+ * first of the dropped records would have been. Each run of drops between
+ * records that were added gets its own count.
+ *
+ * Each record starts with the byte 0xFE, which never appears in text, so
+ * records can be mixed with other Serial output. The logdecode programme
+ * turns them back into text.
+ *
+ * Frame record (19 bytes): 0xFE, 0x01, frame length (16-bit), destination
+ * and source MAC addresses (6 bytes each), EtherType (16-bit), the value of
+ * byte 15 of the frame.
+ *
+ * Dropped record (6 bytes): 0xFE, 0x02, number of frame records dropped (32-bit).
+ *
+ * Numbers are little endian.
+ */
+class FrameLog {
+
+public:
+    /** Bytes written out for a frame record */
+    static const uint8_t RecordLength = 19;
+
+    FrameLog();
+
+    /**
+     * Add a record about a frame
+     * @param destination the destination MAC address (6 bytes)
+     * @param source the source MAC address (6 bytes)
+     * @param ethertype the EtherType of the frame
+     * @param length the length of the frame
+     * @param value the value of byte 15 of the frame
+     * @return false if the log is full and the record was dropped
+     */
+    boolean add(const uint8_t *destination, const uint8_t *source,
+                uint16_t ethertype, uint16_t length, uint8_t value);
+
+    /**
+     * Write out the oldest record
+     * At most RecordLength bytes are written, so if there is that much space
+     * in the Serial transmit buffer, this doesn't wait.
+     *
+     * @param out the stream to write to, such as Serial
+     * @return true if a record was written, false if the log is empty
+     */
+    boolean drain(Print &out);
+
+    /**
+     * Get the number of records waiting to be written out
+     * @return the number of records
+     */
+    uint8_t pending() const { return _count; }
+
+    /**
+     * Get the number of records that were dropped because the log was full
+     * @return the number of records
+     */
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    static const uint8_t Marker = 0xFE;
+    static const uint8_t FrameRecord = 0x01;
+    static const uint8_t DroppedRecord = 0x02;
+
+    struct Record {
+        uint8_t destination[6];
+        uint8_t source[6];
+        uint16_t ethertype;
+        uint16_t length;
+        uint8_t value;
+        uint32_t dropped;       /* Records dropped after this one was added */
+    };
+
+    Record _records[W5100_LOG_SIZE];
+    uint8_t _first;          /* Index of the oldest record */
+    uint8_t _count;          /* Number of records in the ring */
+    uint32_t _unreported;    /* Drops after the last record written out, to report next */
+    uint32_t _dropped;       /* Records dropped since the log was created */
+};
+
+#endif // W5100_LOG_H
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2013, WIZnet Co., Ltd.
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_REGS_H
+#define	W5100_REGS_H
+
+#include <stdint.h>
+
+/**
+ * Compile-time description of the W5100 registers and buffer memory
+ *
+ * Each register is a type that carries its address, width and access mode,
+ * so the accessors in Wiznet5100 use fixed addresses and can refuse,
+ * at compile time, to write a read-only register.
+ */
+struct WiznetRegisters {
+
+    /** Register access modes */
+    enum Access {
+        ReadOnly = 0x1,     ///< Can only be read
+        WriteOnly = 0x2,    ///< Can only be written
+        ReadWrite = 0x3,    ///< Can be read and written
+    };
+
+    /**
+     * A register in the address space of the chip
+     * @tparam Address the address of the first byte, most significant first
+     * @tparam Width the number of bytes
+     * @tparam Mode the Access mode
+     */
+    template <uint16_t Address, uint8_t Width, uint8_t Mode>
+    struct Register {
+        static const uint16_t address = Address;
+        static const uint8_t width = Width;
+        static const bool readable = (Mode & ReadOnly) != 0;
+        static const bool writable = (Mode & WriteOnly) != 0;
+    };
+
+    /**
+     * The type used to hold the value of a register
+     * Only 1 and 2 byte registers have one, others are read and written as buffers.
+     */
+    template <uint8_t Width> struct Value;
+
+    /** Common registers */
+    typedef Register<0x0000, 1, ReadWrite> MR;      ///< Mode Register
+    typedef Register<0x0001, 4, ReadWrite> GAR;     ///< Gateway IP Register
+    typedef Register<0x0005, 4, ReadWrite> SUBR;    ///< Subnet mask Register
+    typedef Register<0x0009, 6, ReadWrite> SHAR;    ///< Source MAC Register
+    typedef Register<0x000F, 4, ReadWrite> SIPR;    ///< Source IP Register
+    typedef Register<0x0015, 1, ReadWrite> IR;      ///< Interrupt Register (write 1 to clear)
+    typedef Register<0x0016, 1, ReadWrite> IMR;     ///< Interrupt Mask Register
+    typedef Register<0x0017, 2, ReadWrite> RTR;     ///< Retry time (1 is 100us)
+    typedef Register<0x0019, 1, ReadWrite> RCR;     ///< Retry count
+    typedef Register<0x001A, 1, ReadWrite> RMSR;    ///< Receive Memory Size
+    typedef Register<0x001B, 1, ReadWrite> TMSR;    ///< Transmit Memory Size
+
+    /** Mode register values */
+    enum {
+        MR_RST = 0x80,    ///< Reset
+        MR_PB = 0x10,     ///< Ping block
+        MR_AI = 0x02,     ///< Address Auto-Increment in Indirect Bus Interface
+        MR_IND = 0x01,    ///< Indirect Bus Interface mode
+    };
+
+    /** Socket Mode Register values */
+    enum {
+        Sn_MR_CLOSE = 0x00,  ///< Unused socket
+        Sn_MR_TCP = 0x01,    ///< TCP
+        Sn_MR_UDP = 0x02,    ///< UDP
+        Sn_MR_IPRAW = 0x03,  ///< IP LAYER RAW SOCK
+        Sn_MR_MACRAW = 0x04, ///< MAC LAYER RAW SOCK
+        Sn_MR_ND = 0x20,     ///< No Delayed Ack(TCP) flag
+        Sn_MR_MF = 0x40,     ///< Use MAC filter
+        Sn_MR_MULTI = 0x80,  ///< support multicating
+    };
+
+    /** Socket Command Register values */
+    enum {
+        Sn_CR_OPEN = 0x01,      ///< Initialise or open socket
+        Sn_CR_CLOSE = 0x10,     ///< Close socket
+        Sn_CR_SEND = 0x20,      ///< Update TX buffer pointer and send data
+        Sn_CR_SEND_MAC = 0x21,  ///< Send data with MAC address, so without ARP process
+        Sn_CR_SEND_KEEP = 0x22, ///< Send keep alive message
+        Sn_CR_RECV = 0x40,      ///< Update RX buffer pointer and receive data
+    };
+
+    /** Socket Interrupt register values */
+    enum {
+        Sn_IR_CON = 0x01,      ///< CON Interrupt
+        Sn_IR_DISCON = 0x02,   ///< DISCON Interrupt
+        Sn_IR_RECV = 0x04,     ///< RECV Interrupt
+        Sn_IR_TIMEOUT = 0x08,  ///< TIMEOUT Interrupt
+        Sn_IR_SENDOK = 0x10,   ///< SEND_OK Interrupt
+    };
+
+    /** Socket Status Register values */
+    enum {
+        SOCK_CLOSED = 0x00,      ///< Closed
+        SOCK_INIT = 0x13,        ///< Initiate state
+        SOCK_LISTEN = 0x14,      ///< Listen state
+        SOCK_SYNSENT = 0x15,     ///< Connection state
+        SOCK_SYNRECV = 0x16,     ///< Connection state
+        SOCK_ESTABLISHED = 0x17, ///< Success to connect
+        SOCK_FIN_WAIT = 0x18,    ///< Closing state
+        SOCK_CLOSING = 0x1A,     ///< Closing state
+        SOCK_TIME_WAIT = 0x1B,   ///< Closing state
+        SOCK_CLOSE_WAIT = 0x1C,  ///< Closing state
+        SOCK_LAST_ACK = 0x1D,    ///< Closing state
+        SOCK_UDP = 0x22,         ///< UDP socket
+        SOCK_IPRAW = 0x32,       ///< IP raw mode socket
+        SOCK_MACRAW = 0x42,      ///< MAC raw mode socket
+    };
+
+    static const uint8_t SocketCount = 4;
+    static const uint16_t SocketBase = 0x0400;     /* Address of the socket 0 registers */
+    static const uint16_t SocketStride = 0x0100;   /* Distance between the registers of each socket */
+
+    /**
+     * The registers of a socket
+     * @tparam Sn the socket number, 0 to 3
+     */
+    template <uint8_t Sn>
+    struct Socket {
+        static_assert(Sn < SocketCount, "The W5100 only has sockets 0 to 3");
+        static const uint16_t base = SocketBase + Sn * SocketStride;
+
+        typedef Register<base + 0x00, 1, ReadWrite> MR;      ///< Socket Mode register
+        typedef Register<base + 0x01, 1, ReadWrite> CR;      ///< Socket command register
+        typedef Register<base + 0x02, 1, ReadWrite> IR;      ///< Socket interrupt register (write 1 to clear)
+        typedef Register<base + 0x03, 1, ReadOnly> SR;       ///< Socket status register
+        typedef Register<base + 0x04, 2, ReadWrite> PORT;    ///< Source port register
+        typedef Register<base + 0x06, 6, ReadWrite> DHAR;    ///< Peer MAC register
+        typedef Register<base + 0x0C, 4, ReadWrite> DIPR;    ///< Peer IP register
+        typedef Register<base + 0x10, 2, ReadWrite> DPORT;   ///< Peer port register
+        typedef Register<base + 0x12, 2, ReadWrite> MSSR;    ///< Maximum Segment Size register
+        typedef Register<base + 0x14, 1, ReadWrite> PROTO;   ///< IP Protocol register
+        typedef Register<base + 0x15, 1, ReadWrite> TOS;     ///< IP Type of Service register
+        typedef Register<base + 0x16, 1, ReadWrite> TTL;     ///< IP Time to live register
+        typedef Register<base + 0x20, 2, ReadOnly> TX_FSR;   ///< Transmit free memory size register
+        typedef Register<base + 0x22, 2, ReadOnly> TX_RD;    ///< Transmit memory read pointer register
+        typedef Register<base + 0x24, 2, ReadWrite> TX_WR;   ///< Transmit memory write pointer register
+        typedef Register<base + 0x26, 2, ReadOnly> RX_RSR;   ///< Received data size register
+        typedef Register<base + 0x28, 2, ReadWrite> RX_RD;   ///< Read pointer of Receive memory
+        typedef Register<base + 0x2A, 2, ReadOnly> RX_WR;    ///< Write pointer of Receive memory
+    };
+
+    /**
+     * Get the address of a register of any socket
+     * @param sn the socket number
+     * @param address the address of the register in socket 0, such as Socket<0>::CR::address
+     * @return the address of the same register in socket sn
+     */
+    static constexpr uint16_t socketRegister(uint8_t sn, uint16_t address) {
+        return address + sn * SocketStride;
+    }
+
+    static const uint16_t TxMemoryAddress = 0x4000; /* Transmit memory, shared by the sockets */
+    static const uint16_t RxMemoryAddress = 0x6000; /* Receive memory, shared by the sockets */
+    static const uint16_t MemoryLength = 0x2000;    /* Size of each of the memories */
+
+    /**
+     * Get the size of a socket's buffer
+     * @param msr the RMSR or TMSR value, 2 bits per socket: 0=1kB, 1=2kB, 2=4kB, 3=8kB
+     * @param sn the socket number
+     * @return the length in bytes
+     */
+    static constexpr uint16_t bufferLength(uint8_t msr, uint8_t sn) {
+        return 1024u << ((msr >> (2 * sn)) & 0x3);
+    }
+
+    /**
+     * Get the position of a socket's buffer in the memory
+     * The buffers are allocated in socket order, one after another.
+     * @param msr the RMSR or TMSR value
+     * @param sn the socket number
+     * @return the offset from the start of the memory, in bytes
+     */
+    static constexpr uint16_t bufferOffset(uint8_t msr, uint8_t sn) {
+        return sn == 0 ? 0 : bufferOffset(msr, sn - 1) + bufferLength(msr, sn - 1);
+    }
+
+    /**
+     * Check that a socket's buffer fits in the memory
+     * Sockets after the memory runs out get no buffer, so can't be used.
+     * @param msr the RMSR or TMSR value
+     * @param sn the socket number
+     * @return true if the whole buffer is in the memory
+     */
+    static constexpr bool bufferFits(uint8_t msr, uint8_t sn) {
+        return (uint32_t)bufferOffset(msr, sn) + bufferLength(msr, sn) <= MemoryLength;
+    }
+};
+
+/**
+ * The W5500 registers that differ from the W5100
+ *
+ * The W5500 keeps the W5100 socket register offsets, but puts each socket's
+ * registers and buffers in their own block, chosen by a block select byte
+ * in every SPI frame. WiznetW5500Bus uses this to translate the W5100 map.
+ */
+struct W5500Registers {
+
+    /** Common registers that moved, or are new */
+    enum {
+        MR = 0x0000,        ///< Mode Register
+        IR = 0x0015,        ///< Interrupt Register
+        IMR = 0x0016,       ///< Interrupt Mask Register
+        SIR = 0x0017,       ///< Socket Interrupt Register
+        SIMR = 0x0018,      ///< Socket Interrupt Mask Register
+        RTR = 0x0019,       ///< Retry time (W5100 0x0017)
+        RCR = 0x001B,       ///< Retry count (W5100 0x0019)
+        VERSIONR = 0x0039,  ///< Chip version, always 0x04
+    };
+
+    /** Socket register offsets with no W5100 equivalent */
+    enum {
+        Sn_RXBUF_SIZE = 0x1E,   ///< Receive buffer size, in kB
+        Sn_TXBUF_SIZE = 0x1F,   ///< Transmit buffer size, in kB
+    };
+
+    /** Bits of the control byte that follows the address */
+    enum {
+        ControlWrite = 0x04,    ///< Write, rather than read
+        ControlVariable = 0x00, ///< Variable length data phase, ended by chip select
+    };
+
+    /** Mode register bits that are the same as the W5100 */
+    enum {
+        MR_MASK = 0x98,     ///< RST, PB and PPPoE
+    };
+
+    /** Socket Mode Register values in MACRAW mode */
+    enum {
+        Sn_MR_MFEN = 0x80,  ///< MAC filter, Sn_MR_MF on the W5100
+    };
+
+    static const uint8_t SocketCount = 8;
+    static const uint16_t MemoryLength = 0x4000; /* Size of each of the Tx and Rx memories */
+    static const uint8_t Version = 0x04;
+
+    /** @return the block select for the common registers */
+    static constexpr uint8_t commonBlock() { return 0x00; }
+
+    /** @return the block select for the registers of socket sn */
+    static constexpr uint8_t socketBlock(uint8_t sn) { return (sn << 2) | 0x01; }
+
+    /** @return the block select for the transmit buffer of socket sn */
+    static constexpr uint8_t txBlock(uint8_t sn) { return (sn << 2) | 0x02; }
+
+    /** @return the block select for the receive buffer of socket sn */
+    static constexpr uint8_t rxBlock(uint8_t sn) { return (sn << 2) | 0x03; }
+};
+
+template <> struct WiznetRegisters::Value<1> { typedef uint8_t type; };
+template <> struct WiznetRegisters::Value<2> { typedef uint16_t type; };
+
+#endif // W5100_REGS_H
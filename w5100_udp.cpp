@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "w5100_udp.h"
+
+template <uint8_t Sn>
+Wiznet5100::Status WiznetUdp<Sn>::begin(uint16_t port)
+{
+    // There must be memory left for this socket after socket 0
+    if (!HasBuffers)
+        return Wiznet5100::StatusClosed;
+
+    _driver.sendSocketCommand<Sn>(WiznetRegisters::Sn_CR_CLOSE);
+    _driver.setSocketReg<typename Socket::MR>(WiznetRegisters::Sn_MR_UDP);
+    _driver.setSocketReg<typename Socket::PORT>(port);
+    if (!_driver.sendSocketCommand<Sn>(WiznetRegisters::Sn_CR_OPEN))
+        return Wiznet5100::StatusNoResponse;
+    if (_driver.getSocketReg<typename Socket::SR>() != WiznetRegisters::SOCK_UDP)
+        return Wiznet5100::StatusClosed;
+
+    return Wiznet5100::StatusOk;
+}
+
+template <uint8_t Sn>
+void WiznetUdp<Sn>::end()
+{
+    _driver.sendSocketCommand<Sn>(WiznetRegisters::Sn_CR_CLOSE);
+    _driver.setSocketReg<typename Socket::IR>(0xFF);
+}
+
+template <uint8_t Sn>
+Wiznet5100::Status WiznetUdp<Sn>::sendTo(const uint8_t *address, uint16_t port, const uint8_t *data, uint16_t len)
+{
+    uint32_t start = micros();
+    uint8_t ir;
+
+    if (len > TxLength)
+        return Wiznet5100::StatusTooLong;
+
+    // Wait for space in the transmit buffer
+    while (_driver.readSocketCounter<typename Socket::TX_FSR>() < len) {
+        if (_driver.getSocketReg<typename Socket::SR>() != WiznetRegisters::SOCK_UDP)
+            return Wiznet5100::StatusClosed;
+        if (WiznetBus::expired(start, _driver.timeout()))
+            return Wiznet5100::StatusTimeout;
+    }
+
+    _driver.setSocketRegBuf<typename Socket::DIPR>(address);
+    _driver.setSocketReg<typename Socket::DPORT>(port);
+
+    uint16_t ptr = _driver.getSocketReg<typename Socket::TX_WR>();
+    _driver.writeSocketTx<Sn>(ptr, data, len);
+    _driver.setSocketReg<typename Socket::TX_WR>(ptr + len);
+    if (!_driver.sendSocketCommand<Sn>(WiznetRegisters::Sn_CR_SEND))
+        return Wiznet5100::StatusNoResponse;
+
+    // Wait for the chip to resolve the address and send it
+    while (!((ir = _driver.getSocketReg<typename Socket::IR>()) & (WiznetRegisters::Sn_IR_SENDOK | WiznetRegisters::Sn_IR_TIMEOUT))) {
+        if (WiznetBus::expired(start, _driver.timeout()))
+            return Wiznet5100::StatusTimeout;
+    }
+    _driver.setSocketReg<typename Socket::IR>(WiznetRegisters::Sn_IR_SENDOK | WiznetRegisters::Sn_IR_TIMEOUT);
+
+    return (ir & WiznetRegisters::Sn_IR_SENDOK) ? Wiznet5100::StatusOk : Wiznet5100::StatusTxFailed;
+}
+
+template <uint8_t Sn>
+boolean WiznetUdp<Sn>::available()
+{
+    return _driver.readSocketCounter<typename Socket::RX_RSR>() >= HeaderLength;
+}
+
+template <uint8_t Sn>
+uint16_t WiznetUdp<Sn>::receive(uint8_t *buffer, uint16_t bufsize, uint8_t *address, uint16_t *port)
+{
+    uint8_t header[HeaderLength];
+    uint16_t len;
+
+    if (!available())
+        return 0;
+
+    // Each datagram starts with the sender's address, port and the payload length
+    uint16_t ptr = _driver.getSocketReg<typename Socket::RX_RD>();
+    _driver.readSocketRx<Sn>(ptr, header, HeaderLength);
+    len = (header[6] << 8) | header[7];
+
+    if (address)
+        memcpy(address, header, 4);
+    if (port)
+        *port = (header[4] << 8) | header[5];
+
+    _driver.readSocketRx<Sn>(ptr + HeaderLength, buffer, len < bufsize ? len : bufsize);
+    _driver.setSocketReg<typename Socket::RX_RD>(ptr + HeaderLength + len);
+    _driver.sendSocketCommand<Sn>(WiznetRegisters::Sn_CR_RECV);
+
+    return len < bufsize ? len : bufsize;
+}
+
+// Socket 0 is the MACRAW socket, so these are the sockets that can be used
+template class WiznetUdp<1>;
+template class WiznetUdp<2>;
+template class WiznetUdp<3>;
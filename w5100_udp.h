@@ -0,0 +1,127 @@
+/*
+ * UDP sockets in the WIZnet chip, alongside the MACRAW socket
+ *
+ * Copyright (c) 2016, Nicholas Humfrey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef	W5100_UDP_H
+#define	W5100_UDP_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "w5100.h"
+
+/**
+ * A UDP socket handled by the chip's own UDP engine
+ *
+ * Sockets 1 to 3 can be used for UDP while socket 0 carries on receiving
+ * and sending raw frames. The chip builds and checks the IP and UDP headers
+ * and answers ARP itself, so the microcontroller only copies the payload.
+ *
+ * The sockets only have buffers if W5100_RMSR and W5100_TMSR leave some
+ * memory after socket 0, and the chip needs an IP address, set with
+ * Wiznet5100::setIPAddress(). After Wiznet5100::reinit(), begin() must
+ * be called again.
+ *
+ * @tparam Sn the socket to use, 1 to 3
+ */
+template <uint8_t Sn>
+class WiznetUdp {
+
+public:
+    /**
+     * @param driver the driver for the chip
+     */
+    WiznetUdp(Wiznet5100 &driver) : _driver(driver) {}
+
+    /**
+     * Open the socket
+     * @param port the local UDP port to receive on and send from
+     * @return StatusOk, StatusNoResponse, or StatusClosed if the socket
+     *         has no buffer memory or didn't open
+     */
+    Wiznet5100::Status begin(uint16_t port);
+
+    /**
+     * Close the socket
+     */
+    void end();
+
+    /**
+     * Send a datagram, and wait for the chip to send it
+     * The time allowed is the one set with Wiznet5100::setTimeout().
+     *
+     * @param address the 4-byte IP address to send to
+     * @param port the UDP port to send to
+     * @param data the payload
+     * @param len the length of the payload
+     * @return StatusOk, StatusTooLong if it will never fit in the transmit buffer,
+     *         StatusTxFailed if the chip couldn't find the address with ARP,
+     *         or another Status if it wasn't sent
+     */
+    Wiznet5100::Status sendTo(const uint8_t *address, uint16_t port, const uint8_t *data, uint16_t len);
+
+    /**
+     * Check whether a datagram has been received
+     * @return true if receive() will return one
+     */
+    boolean available();
+
+    /**
+     * Receive a datagram
+     * If the payload is bigger than the buffer, the rest of it is dropped.
+     *
+     * @param buffer the buffer to copy the payload to
+     * @param bufsize the size of the buffer
+     * @param address set to the 4-byte IP address of the sender, or NULL
+     * @param port set to the UDP port of the sender, or NULL
+     * @return the number of bytes copied, or 0 if nothing was received
+     */
+    uint16_t receive(uint8_t *buffer, uint16_t bufsize, uint8_t *address = NULL, uint16_t *port = NULL);
+
+private:
+    static_assert(Sn != 0, "Socket 0 is the MACRAW socket");
+
+    static const uint8_t HeaderLength = 8;  /* Sender address, port and length before each datagram */
+
+    typedef WiznetRegisters::Socket<Sn> Socket;
+
+    static const uint16_t TxLength = WiznetRegisters::bufferLength(W5100_TMSR, Sn);
+
+    /* Whether W5100_RMSR and W5100_TMSR left memory for this socket. This can't be
+       a static_assert, because the default sizes give it all to socket 0. */
+    static const bool HasBuffers = WiznetRegisters::bufferFits(W5100_TMSR, Sn) &&
+                                   WiznetRegisters::bufferFits(W5100_RMSR, Sn);
+
+    Wiznet5100 &_driver;
+};
+
+#endif // W5100_UDP_H